@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+struct arena_region {
+	struct arena_region	*next;
+	size_t			size;	/* Of the mapping, header included. */
+	size_t			used;	/* From the start of the mapping. */
+};
+
+static inline size_t align_up(size_t x, size_t align)
+{
+	return (x + align - 1) & ~(align - 1);
+}
+
+void arena_init(struct arena *a, size_t region_size, int flags)
+{
+	memset(a, 0, sizeof(*a));
+	a->region_size = region_size ? region_size : ARENA_DEF_REGION;
+	a->flags = flags;
+}
+
+static struct arena_region *map_region(struct arena *a, size_t size)
+{
+	struct arena_region *r = MAP_FAILED;
+	int huge = 0;
+
+	if (a->flags & ARENA_F_HUGE) {
+		size = align_up(size, ARENA_HUGE_PAGE_SIZE);
+		r = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		huge = r != MAP_FAILED;
+	} else {
+		size = align_up(size, ARENA_PAGE_SIZE);
+	}
+	if (r == MAP_FAILED) {
+		r = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (r == MAP_FAILED)
+			return NULL;
+		if (a->flags & ARENA_F_HUGE)
+			/* Only a hint; the region works either way. */
+			madvise(r, size, MADV_HUGEPAGE);
+	}
+
+	r->next = NULL;
+	r->size = size;
+	r->used = sizeof(*r);
+	a->stats.regions++;
+	a->stats.huge_regions += huge;
+	a->stats.mapped += size;
+	return r;
+}
+
+void arena_destroy(struct arena *a)
+{
+	struct arena_region *r = a->first;
+
+	while (r) {
+		struct arena_region *next = r->next;
+		assert(!munmap(r, r->size));
+		r = next;
+	}
+	a->first = a->cur = a->last = NULL;
+}
+
+/* Carve @size bytes aligned to @align out of @r, or return NULL. */
+static void *region_alloc(struct arena_region *r, size_t size, size_t align)
+{
+	uintptr_t base = (uintptr_t)r;
+	uintptr_t p = align_up(base + r->used, align);
+
+	if (p + size > base + r->size)
+		return NULL;
+	r->used = p + size - base;
+	return (void *)p;
+}
+
+void *arena_alloc_aligned(struct arena *a, size_t size, size_t align)
+{
+	struct arena_region *r;
+	void *p = NULL;
+
+	assert(align && !(align & (align - 1)));
+
+	/* Regions past @a->cur are only left over from before a reset. */
+	for (r = a->cur; r; r = r->next) {
+		p = region_alloc(r, size, align);
+		if (p)
+			break;
+	}
+	if (!p) {
+		size_t need = align_up(sizeof(*r), align) + size;
+
+		if (need < a->region_size)
+			need = a->region_size;
+		r = map_region(a, need);
+		if (!r)
+			return NULL;
+		if (a->last)
+			a->last->next = r;
+		else
+			a->first = r;
+		a->last = r;
+		p = region_alloc(r, size, align);
+		assert(p);
+	}
+
+	a->cur = r;
+	a->stats.allocs++;
+	a->stats.used += size;
+	if (a->stats.used > a->stats.peak)
+		a->stats.peak = a->stats.used;
+	return p;
+}
+
+void arena_reset(struct arena *a)
+{
+	struct arena_region *r;
+
+	for (r = a->first; r; r = r->next)
+		r->used = sizeof(*r);
+	a->cur = a->first;
+	a->stats.used = 0;
+	a->stats.resets++;
+}
+
+void arena_stats_add(struct arena_stats *sum, const struct arena_stats *st)
+{
+	sum->allocs += st->allocs;
+	sum->resets += st->resets;
+	sum->regions += st->regions;
+	sum->huge_regions += st->huge_regions;
+	sum->mapped += st->mapped;
+	sum->used += st->used;
+	sum->peak += st->peak;
+}
+
+void pool_init(struct pool *p, size_t obj_size, size_t region_size,
+	       int flags)
+{
+	memset(p, 0, sizeof(*p));
+	assert(!pthread_mutex_init(&p->lock, NULL));
+	arena_init(&p->arena, region_size, flags);
+	/* Every object, and so the link of a free one, stays aligned. */
+	p->obj_size = align_up(obj_size, ARENA_ALIGN);
+}
+
+void pool_destroy(struct pool *p)
+{
+	arena_destroy(&p->arena);
+	assert(!pthread_mutex_destroy(&p->lock));
+}
+
+void *pool_get(struct pool *p)
+{
+	void *obj;
+
+	assert(!pthread_mutex_lock(&p->lock));
+	obj = p->free_list;
+	if (obj)
+		p->free_list = *(void **)obj;
+	else
+		obj = arena_alloc(&p->arena, p->obj_size);
+	if (obj) {
+		p->stats.gets++;
+		if (++p->stats.in_use > p->stats.max_in_use)
+			p->stats.max_in_use = p->stats.in_use;
+	}
+	assert(!pthread_mutex_unlock(&p->lock));
+	return obj;
+}
+
+void pool_put(struct pool *p, void *obj)
+{
+	assert(!pthread_mutex_lock(&p->lock));
+	*(void **)obj = p->free_list;
+	p->free_list = obj;
+	p->stats.puts++;
+	p->stats.in_use--;
+	assert(!pthread_mutex_unlock(&p->lock));
+}
+
+void arena_print_stats(FILE *f, const char *name,
+		       const struct arena_stats *st)
+{
+	fprintf(f, "%s: %lu allocations, %lu resets, %lu regions "
+		"(%lu on huge pages), %.1f MB mapped, %.1f MB at most "
+		"in use\n", name, st->allocs, st->resets, st->regions,
+		st->huge_regions, st->mapped / 1048576.0,
+		st->peak / 1048576.0);
+}
+
+void pool_print_stats(FILE *f, const char *name, struct pool *p)
+{
+	struct pool_stats st;
+	size_t mapped;
+
+	assert(!pthread_mutex_lock(&p->lock));
+	st = p->stats;
+	mapped = p->arena.stats.mapped;
+	assert(!pthread_mutex_unlock(&p->lock));
+	fprintf(f, "%s: %lu objects of %zu bytes taken, %lu at most at "
+		"once, %.1f MB mapped\n", name, st.gets, p->obj_size,
+		st.max_in_use, mapped / 1048576.0);
+}
@@ -0,0 +1,100 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Every allocation starts on a cache line, which is also as wide as
+ * the widest vector registers the coding routines use.
+ */
+#define ARENA_ALIGN		64
+#define ARENA_PAGE_SIZE		4096
+#define ARENA_HUGE_PAGE_SIZE	(2 << 20)
+
+/* Regions are this large unless an allocation needs more. */
+#define ARENA_DEF_REGION	(1 << 20)
+
+/* Back regions with huge pages: explicit ones when the system has any
+ * to spare, else transparent ones.
+ */
+#define ARENA_F_HUGE		0x1
+
+struct arena_stats {
+	unsigned long	allocs;
+	unsigned long	resets;
+	unsigned long	regions;
+	/* Of @regions, those on explicit huge pages. */
+	unsigned long	huge_regions;
+	size_t		mapped;		/* Bytes mapped for regions. */
+	size_t		used;		/* Bytes handed out since the reset. */
+	size_t		peak;		/* Most of @used. */
+};
+
+struct arena_region;
+
+/* Bump allocator over mapped regions. Allocations are given back all
+ * at once by arena_reset(), which keeps the regions for the next
+ * round, or by arena_destroy(). An arena is not locked, so every
+ * thread keeps its own.
+ */
+struct arena {
+	struct arena_region	*first;
+	struct arena_region	*cur;		/* Where allocations go. */
+	struct arena_region	*last;
+	size_t			region_size;
+	int			flags;
+	struct arena_stats	stats;
+};
+
+/* @region_size of 0 picks ARENA_DEF_REGION. */
+void arena_init(struct arena *a, size_t region_size, int flags);
+void arena_destroy(struct arena *a);
+
+/* @align is a power of two; arena_alloc() aligns to ARENA_ALIGN.
+ * Returns NULL if no region can be mapped.
+ */
+void *arena_alloc_aligned(struct arena *a, size_t size, size_t align);
+
+static inline void *arena_alloc(struct arena *a, size_t size)
+{
+	return arena_alloc_aligned(a, size, ARENA_ALIGN);
+}
+
+void arena_reset(struct arena *a);
+
+/* Add the stats of one arena to the totals of several in @sum. */
+void arena_stats_add(struct arena_stats *sum, const struct arena_stats *st);
+
+struct pool_stats {
+	unsigned long	gets;
+	unsigned long	puts;
+	unsigned long	in_use;
+	unsigned long	max_in_use;
+};
+
+/* Objects of one size carved out of an arena and recycled through a
+ * free list. Unlike an arena, a pool is locked, so that an object can
+ * be put back by another thread than the one that got it.
+ */
+struct pool {
+	pthread_mutex_t		lock;
+	struct arena		arena;
+	size_t			obj_size;
+	void			*free_list;
+	struct pool_stats	stats;
+};
+
+void pool_init(struct pool *p, size_t obj_size, size_t region_size,
+	       int flags);
+void pool_destroy(struct pool *p);
+
+/* Returns NULL if the arena of @p cannot grow. */
+void *pool_get(struct pool *p);
+void pool_put(struct pool *p, void *obj);
+
+void arena_print_stats(FILE *f, const char *name,
+		       const struct arena_stats *st);
+void pool_print_stats(FILE *f, const char *name, struct pool *p);
+
+#endif /* _ARENA_H */
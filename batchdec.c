@@ -0,0 +1,264 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "codec.h"
+#include "blkdir.h"
+#include "batchdec.h"
+
+#define USAGE	"usage:\t./decoder -b [-t threads] dir output-file\n"
+
+/* Time spent in each stage, summed over threads. */
+struct stage_times {
+	double	read;
+	double	decode;
+	double	write;
+};
+
+/* A received file as block directories, decoded to @out_fd. */
+struct batch {
+	struct blkdir		bd;
+	int			out_fd;
+	struct codec		codec;		/* Shared by all threads. */
+	pthread_mutex_t		lock;
+	/* Protected by @lock. */
+	unsigned int		next;
+	unsigned int		copied;
+	unsigned int		decoded;
+	unsigned int		failed;
+	struct stage_times	times;
+	struct arena_stats	arenas;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Read chunk @idx of block @id into @buf. Returns 0, or -1 if it was
+ * never received.
+ */
+static int read_chunk(const struct batch *b, unsigned int id, int idx,
+		      char *buf)
+{
+	char path[PATH_MAX];
+	ssize_t rc;
+	int fd;
+
+	if (blkdir_chunk_path(&b->bd, id, idx, path, sizeof(path)))
+		return -1;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	rc = read(fd, buf, b->bd.chunk_size);
+	close(fd);
+	if (rc != b->bd.chunk_size) {
+		fprintf(stderr, "Ignoring short chunk %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Rebuild block @id in @buf, which has room for all of its chunks, and
+ * write it to its place in the output file.
+ */
+static int decode_block(struct batch *b, unsigned int id, char *buf,
+			struct stage_times *t, int *decoded)
+{
+	const struct blkdir *bd = &b->bd;
+	const char *name = bd->names[id];
+	char *data[bd->k], *coding[bd->m];
+	int erasures[bd->k + bd->m + 1];
+	int i, num_erased = 0, data_erased;
+	size_t block_size = (size_t)bd->k * bd->chunk_size;
+	double start = now(), end;
+
+	if (!name) {
+		fprintf(stderr, "Block %u was never received\n", id);
+		return -1;
+	}
+
+	for (i = 0; i < bd->k; i++) {
+		data[i] = buf + i * bd->chunk_size;
+		if (read_chunk(b, id, i, data[i]))
+			erasures[num_erased++] = i;
+	}
+	data_erased = num_erased;
+	/* Coding chunks are only read for blocks that need them. */
+	for (i = 0; i < bd->m; i++) {
+		coding[i] = buf + block_size + i * bd->chunk_size;
+		if (!data_erased || read_chunk(b, id, bd->k + i, coding[i]))
+			erasures[num_erased++] = bd->k + i;
+	}
+	erasures[num_erased] = -1;
+	*decoded = !!data_erased;
+	end = now();
+	t->read += end - start;
+	start = end;
+
+	if (*decoded) {
+		if (num_erased > bd->m ||
+		    codec_decode(&b->codec, erasures, data, coding,
+				 bd->chunk_size) < 0) {
+			fprintf(stderr, "Cannot decode block %s\n", name);
+			return -1;
+		}
+		end = now();
+		t->decode += end - start;
+		start = end;
+	}
+
+	if (pwrite(b->out_fd, buf, block_size, (off_t)id * block_size) !=
+	    (ssize_t)block_size) {
+		fprintf(stderr, "%s: pwrite errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+		return -1;
+	}
+	t->write += now() - start;
+	return 0;
+}
+
+static void *batch_thread(void *arg)
+{
+	struct batch *b = arg;
+	struct stage_times t;
+	struct arena arena;
+	char *buf;
+	unsigned int id;
+	int rc, decoded;
+
+	/* Scratch space for the chunks of one block, reused for every
+	 * block the thread takes, from an arena of the thread's own.
+	 */
+	arena_init(&arena, 0, ARENA_F_HUGE);
+	buf = arena_alloc(&arena,
+			  (size_t)(b->bd.k + b->bd.m) * b->bd.chunk_size);
+	assert(buf);
+	memset(&t, 0, sizeof(t));
+
+	while (1) {
+		assert(!pthread_mutex_lock(&b->lock));
+		id = b->next++;
+		assert(!pthread_mutex_unlock(&b->lock));
+		if (id >= b->bd.num_blocks)
+			break;
+
+		decoded = 0;
+		rc = decode_block(b, id, buf, &t, &decoded);
+
+		assert(!pthread_mutex_lock(&b->lock));
+		if (rc)
+			b->failed++;
+		else if (decoded)
+			b->decoded++;
+		else
+			b->copied++;
+		assert(!pthread_mutex_unlock(&b->lock));
+	}
+
+	assert(!pthread_mutex_lock(&b->lock));
+	b->times.read += t.read;
+	b->times.decode += t.decode;
+	b->times.write += t.write;
+	arena_stats_add(&b->arenas, &arena.stats);
+	assert(!pthread_mutex_unlock(&b->lock));
+	arena_destroy(&arena);
+	return NULL;
+}
+
+int batch_decode_main(int argc, char **argv)
+{
+	struct batch b;
+	pthread_t *threads;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	double start, scanned, end;
+	off_t file_size;
+	int opt, i, rc = 1;
+
+	optind = 1;
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			if (sscanf(optarg, "%ld", &num_threads) != 1 ||
+			    num_threads <= 0) {
+				fprintf(stderr, "Invalid number of threads: "
+					"%s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, USAGE);
+		return 1;
+	}
+	if (num_threads <= 0)
+		num_threads = 1;
+
+	memset(&b, 0, sizeof(b));
+	start = now();
+	if (blkdir_open(&b.bd, argv[optind]))
+		goto bd;
+	scanned = now();
+
+	if (codec_init(&b.codec, b.bd.k, b.bd.m)) {
+		fprintf(stderr, "codec_init: cannot create coding matrix\n");
+		goto bd;
+	}
+
+	b.out_fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (b.out_fd < 0) {
+		fprintf(stderr, "%s: open errno=%i on %s: %s\n", __func__,
+			errno, argv[optind + 1], strerror(errno));
+		goto codec;
+	}
+
+	assert(!pthread_mutex_init(&b.lock, NULL));
+	threads = malloc(num_threads * sizeof(*threads));
+	assert(threads);
+	for (i = 0; i < num_threads; i++)
+		assert(!pthread_create(&threads[i], NULL, batch_thread, &b));
+	for (i = 0; i < num_threads; i++)
+		assert(!pthread_join(threads[i], NULL));
+	free(threads);
+	assert(!pthread_mutex_destroy(&b.lock));
+
+	/* Strip the padding that the sender added to the last block. */
+	file_size = (off_t)b.bd.num_blocks * b.bd.k * b.bd.chunk_size -
+		    b.bd.padding;
+	if (ftruncate(b.out_fd, file_size) < 0)
+		fprintf(stderr, "%s: ftruncate errno=%i: %s\n", __func__,
+			errno, strerror(errno));
+	else if (!b.failed)
+		rc = 0;
+	assert(!close(b.out_fd));
+	end = now();
+
+	printf("%u blocks, %ld threads: %u copied, %u decoded, %u failed\n",
+	       b.bd.num_blocks, num_threads, b.copied, b.decoded, b.failed);
+	printf("Scan %.3f s; read %.3f s, decode %.3f s, write %.3f s "
+	       "(summed over threads)\n", scanned - start, b.times.read,
+	       b.times.decode, b.times.write);
+	printf("Total %.3f s (%.2f MB/s)\n", end - start,
+	       file_size / 1024.0 / 1024.0 / (end - start));
+	arena_print_stats(stdout, "Scratch", &b.arenas);
+
+codec:
+	codec_free(&b.codec);
+bd:
+	blkdir_close(&b.bd);
+	return rc;
+}
@@ -0,0 +1,10 @@
+#ifndef _BATCHDEC_H
+#define _BATCHDEC_H
+
+/* Decode every block directory of a received file on a pool of threads
+ * and write the file out: ./decoder -b [-t threads] dir output-file.
+ * @argv[0] is "-b". Returns the exit status.
+ */
+int batch_decode_main(int argc, char **argv);
+
+#endif /* _BATCHDEC_H */
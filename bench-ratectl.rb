@@ -0,0 +1,63 @@
+#
+# bench-ratectl.rb: compare the rate controllers of fountain-send
+#
+# Send the same file once with every rate controller to a local
+# fountain-recv, optionally through a netem qdisc, and report the
+# goodput the receiver saw and the loss the sender measured.
+#
+
+RATECTLS =	["fixed", "aimd", "delay"]
+SENDER =	"./fountain-send"
+RECEIVER =	"./fountain-recv"
+FEEDBACK_MS =	50
+LINGER_S =	5
+RECV_LOG =	"recv.log"
+SEND_LOG =	"send.log"
+SEND_STATS =	Regexp.new('(\d+) pps at the end, \d+ reports, ' \
+			   '([\d.]+)% loss, ([\d.]+) ms RTT')
+
+USAGE =
+  "\nUsage:\n"                                                        \
+  "\truby bench-ratectl.rb [--netem dev \"netem-args\"] [--pps pps] " \
+  "srv-bind-addr\n\t\tsrv-dst-addr cli-bind-addr file-path\n\n"       \
+  "With --netem, the traffic of dev goes through\n"                   \
+  "\ttc qdisc replace dev <dev> root netem <netem-args>\n"            \
+  "for the whole run, e.g. --netem lo \"delay 10ms loss 1% rate 100mbit\".\n\n"
+
+def run(ratectl, pps, srv_bind, srv_dst, cli_bind, file_path)
+  recv = spawn("#{RECEIVER} -f #{FEEDBACK_MS} #{cli_bind}", :err => RECV_LOG)
+  sleep(0.5)
+  system("#{SENDER} -R #{ratectl} -p #{pps} -L #{LINGER_S} " \
+         "#{srv_bind} #{srv_dst} #{file_path} 0", :err => SEND_LOG)
+  Process.wait(recv)
+
+  goodput = File.read(RECV_LOG)[/\(([\d.]+) MB\/s\)/, 1] || "failed"
+  stats = File.read(SEND_LOG).match(SEND_STATS)
+  return [goodput] + (stats ? stats.captures : ["-", "-", "-"])
+end
+
+if __FILE__ == $PROGRAM_NAME
+  netem = nil
+  if (i = ARGV.index("--netem"))
+    netem = ARGV.slice!(i, 3).drop(1)
+  end
+  pps = 10000
+  if (i = ARGV.index("--pps"))
+    pps = ARGV.slice!(i, 2)[1].to_i
+  end
+  if ARGV.length != 4 or (netem and netem.length != 2)
+    puts(USAGE)
+    exit
+  end
+
+  system("tc qdisc replace dev #{netem[0]} root netem #{netem[1]}") if netem
+  begin
+    printf("%-8s %12s %12s %8s %10s\n",
+           "ratectl", "goodput MB/s", "final pps", "loss %", "RTT ms")
+    RATECTLS.each do |ratectl|
+      printf("%-8s %12s %12s %8s %10s\n", ratectl, *run(ratectl, pps, *ARGV))
+    end
+  ensure
+    system("tc qdisc del dev #{netem[0]} root") if netem
+  end
+end
@@ -0,0 +1,204 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "blkcache.h"
+
+struct blkcache_entry {
+	struct blkcache_key	key;
+	struct blkcache_entry	*hnext;
+	struct blkcache_entry	*prev;	/* Towards the most recently used. */
+	struct blkcache_entry	*next;	/* Towards the least recently used. */
+	char			data[];
+};
+
+struct blkcache {
+	pthread_mutex_t		lock;
+	struct blkcache_entry	**buckets;
+	unsigned int		num_buckets;
+	struct blkcache_entry	*mru;
+	struct blkcache_entry	*lru;
+	size_t			budget;
+	size_t			entry_size;
+	int			chunks_per_block;
+	int			chunk_size;
+	struct blkcache_stats	stats;
+};
+
+static inline int key_equal(const struct blkcache_key *a,
+			    const struct blkcache_key *b)
+{
+	return a->block_id == b->block_id && a->ino == b->ino &&
+	       a->dev == b->dev && a->size == b->size &&
+	       a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec;
+}
+
+static inline unsigned int key_hash(const struct blkcache *cache,
+				    const struct blkcache_key *key)
+{
+	__u64 h = key->ino * 0x9e3779b97f4a7c15ULL;
+	h ^= key->dev + (h << 6) + (h >> 2);
+	h ^= key->block_id * 0xc2b2ae3d27d4eb4fULL;
+	h ^= h >> 29;
+	return h & (cache->num_buckets - 1);
+}
+
+struct blkcache *blkcache_create(size_t budget, int chunks_per_block,
+				 int chunk_size)
+{
+	struct blkcache *cache = calloc(1, sizeof(*cache));
+	size_t max_entries;
+
+	if (!cache)
+		return NULL;
+
+	cache->budget = budget;
+	cache->chunks_per_block = chunks_per_block;
+	cache->chunk_size = chunk_size;
+	cache->entry_size = sizeof(struct blkcache_entry) +
+			    (size_t)chunks_per_block * chunk_size;
+
+	/* Keep the load factor of the table at or below one. */
+	max_entries = budget / cache->entry_size;
+	cache->num_buckets = 1;
+	while (cache->num_buckets < max_entries)
+		cache->num_buckets <<= 1;
+
+	cache->buckets = calloc(cache->num_buckets, sizeof(*cache->buckets));
+	if (!cache->buckets) {
+		free(cache);
+		return NULL;
+	}
+	assert(!pthread_mutex_init(&cache->lock, NULL));
+	return cache;
+}
+
+void blkcache_destroy(struct blkcache *cache)
+{
+	struct blkcache_entry *e = cache->mru;
+
+	while (e) {
+		struct blkcache_entry *next = e->next;
+		free(e);
+		e = next;
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->buckets);
+	free(cache);
+}
+
+static void lru_unlink(struct blkcache *cache, struct blkcache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		cache->mru = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		cache->lru = e->prev;
+}
+
+static void lru_push(struct blkcache *cache, struct blkcache_entry *e)
+{
+	e->prev = NULL;
+	e->next = cache->mru;
+	if (cache->mru)
+		cache->mru->prev = e;
+	else
+		cache->lru = e;
+	cache->mru = e;
+}
+
+static struct blkcache_entry **lookup(struct blkcache *cache,
+				      const struct blkcache_key *key)
+{
+	struct blkcache_entry **pe = &cache->buckets[key_hash(cache, key)];
+
+	while (*pe && !key_equal(&(*pe)->key, key))
+		pe = &(*pe)->hnext;
+	return pe;
+}
+
+static void evict_lru(struct blkcache *cache)
+{
+	struct blkcache_entry *e = cache->lru;
+	struct blkcache_entry **pe = lookup(cache, &e->key);
+
+	assert(*pe == e);
+	*pe = e->hnext;
+	lru_unlink(cache, e);
+	free(e);
+	cache->stats.bytes -= cache->entry_size;
+	cache->stats.evictions++;
+}
+
+int blkcache_get(struct blkcache *cache, const struct blkcache_key *key,
+		 char **chunks)
+{
+	struct blkcache_entry *e;
+	int i;
+
+	pthread_mutex_lock(&cache->lock);
+	e = *lookup(cache, key);
+	if (!e) {
+		cache->stats.misses++;
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	lru_unlink(cache, e);
+	lru_push(cache, e);
+	for (i = 0; i < cache->chunks_per_block; i++)
+		memcpy(chunks[i], e->data + i * cache->chunk_size,
+		       cache->chunk_size);
+	cache->stats.hits++;
+	pthread_mutex_unlock(&cache->lock);
+	return 1;
+}
+
+void blkcache_put(struct blkcache *cache, const struct blkcache_key *key,
+		  char **chunks)
+{
+	struct blkcache_entry *e, **pe;
+	int i;
+
+	if (cache->entry_size > cache->budget)
+		return;
+
+	/* Copy outside of the lock. */
+	e = malloc(cache->entry_size);
+	if (!e)
+		return;
+	e->key = *key;
+	for (i = 0; i < cache->chunks_per_block; i++)
+		memcpy(e->data + i * cache->chunk_size, chunks[i],
+		       cache->chunk_size);
+
+	pthread_mutex_lock(&cache->lock);
+	pe = lookup(cache, key);
+	if (*pe) {
+		/* Another thread encoded the same block. */
+		pthread_mutex_unlock(&cache->lock);
+		free(e);
+		return;
+	}
+
+	while (cache->stats.bytes + cache->entry_size > cache->budget)
+		evict_lru(cache);
+
+	/* Eviction may have changed the chain, so look up again. */
+	pe = lookup(cache, key);
+	e->hnext = NULL;
+	*pe = e;
+	lru_push(cache, e);
+	cache->stats.bytes += cache->entry_size;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void blkcache_get_stats(struct blkcache *cache, struct blkcache_stats *st)
+{
+	pthread_mutex_lock(&cache->lock);
+	*st = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,51 @@
+#ifndef _BLKCACHE_H
+#define _BLKCACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+/* Identifies a version of a source file, so that a file that is
+ * modified in place never serves stale coding chunks.
+ */
+struct blkcache_key {
+	dev_t	dev;
+	ino_t	ino;
+	off_t	size;
+	time_t	mtime;
+	long	mtime_nsec;
+	__u32	block_id;
+};
+
+struct blkcache_stats {
+	unsigned long	hits;
+	unsigned long	misses;
+	unsigned long	evictions;
+	size_t		bytes;
+};
+
+struct blkcache;
+
+/* LRU cache of the coding chunks of encoded blocks that holds at most
+ * @budget bytes, entries included. The cache is safe to share among
+ * threads.
+ */
+struct blkcache *blkcache_create(size_t budget, int chunks_per_block,
+				 int chunk_size);
+void blkcache_destroy(struct blkcache *cache);
+
+/* Copy the chunks cached for @key into @chunks[0..chunks_per_block-1].
+ * Returns 1 on a hit and 0 on a miss.
+ */
+int blkcache_get(struct blkcache *cache, const struct blkcache_key *key,
+		 char **chunks);
+
+/* Insert a copy of @chunks for @key, evicting the least recently
+ * used blocks as needed.
+ */
+void blkcache_put(struct blkcache *cache, const struct blkcache_key *key,
+		  char **chunks);
+
+void blkcache_get_stats(struct blkcache *cache, struct blkcache_stats *st);
+
+#endif /* _BLKCACHE_H */
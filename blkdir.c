@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include "codec.h"
+#include "blkdir.h"
+
+#define PADDING_FILE		"padding.txt"
+#define CODING_TECH		"cauchy_good"
+
+/* Read the geometry of the file from the meta file of block @name. */
+static int read_meta(struct blkdir *bd, const char *name)
+{
+	char path[PATH_MAX], tech[64];
+	int origsize, w, packetsize, buffersize, rc;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s/%s_meta.txt", bd->dir, name,
+		 name);
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "%s: fopen errno=%i on %s: %s\n",
+			__func__, errno, path, strerror(errno));
+		return -1;
+	}
+	rc = fscanf(f, "%*s %d %d %d %d %d %d %63s", &origsize, &bd->k,
+		    &bd->m, &w, &packetsize, &buffersize, tech);
+	fclose(f);
+	if (rc != 7 || bd->k <= 0 || bd->m <= 0 || buffersize % bd->k) {
+		fprintf(stderr, "Invalid meta file %s\n", path);
+		return -1;
+	}
+	if (strcmp(tech, CODING_TECH) || w != CODEC_WORD_SIZE ||
+	    packetsize != CODEC_PACKET_SIZE) {
+		fprintf(stderr, "%s: only %s with w=%d and a packet size of %d "
+			"is supported\n", path, CODING_TECH, CODEC_WORD_SIZE,
+			CODEC_PACKET_SIZE);
+		return -1;
+	}
+	bd->chunk_size = buffersize / bd->k;
+	snprintf(tech, sizeof(tech), "%d", bd->k);
+	bd->md = strlen(tech);
+	return 0;
+}
+
+static int read_padding(const char *dir)
+{
+	char path[PATH_MAX];
+	int padding = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, PADDING_FILE);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%d", &padding) != 1 || padding < 0)
+		padding = 0;
+	fclose(f);
+	return padding;
+}
+
+int blkdir_open(struct blkdir *bd, const char *dir)
+{
+	struct dirent *ent;
+	unsigned int id, size = 0;
+	DIR *d;
+	int len;
+
+	memset(bd, 0, sizeof(*bd));
+	bd->dir = strdup(dir);
+	assert(bd->dir);
+	d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "%s: opendir errno=%i on %s: %s\n",
+			__func__, errno, dir, strerror(errno));
+		return -1;
+	}
+	while ((ent = readdir(d))) {
+		if (sscanf(ent->d_name, "b%u%n", &id, &len) != 1 ||
+		    ent->d_name[len])
+			continue;
+		if (id >= size) {
+			unsigned int new_size = size ? size : 64;
+			char **names;
+
+			while (new_size <= id)
+				new_size *= 2;
+			names = realloc(bd->names, new_size * sizeof(*names));
+			assert(names);
+			memset(names + size, 0,
+			       (new_size - size) * sizeof(*names));
+			bd->names = names;
+			size = new_size;
+		}
+		bd->names[id] = strdup(ent->d_name);
+		assert(bd->names[id]);
+		if (id >= bd->num_blocks)
+			bd->num_blocks = id + 1;
+	}
+	closedir(d);
+
+	if (!bd->num_blocks) {
+		fprintf(stderr, "No blocks in %s\n", dir);
+		return -1;
+	}
+	for (id = 0; !bd->names[id]; id++)
+		;
+	if (read_meta(bd, bd->names[id]))
+		return -1;
+	bd->padding = read_padding(dir);
+	return 0;
+}
+
+void blkdir_close(struct blkdir *bd)
+{
+	__u32 i;
+
+	for (i = 0; bd->names && i < bd->num_blocks; i++)
+		free(bd->names[i]);
+	free(bd->names);
+	free(bd->dir);
+}
+
+int blkdir_chunk_path(const struct blkdir *bd, __u32 block_id, int idx,
+		      char *path, size_t size)
+{
+	const char *name = bd->names[block_id];
+
+	if (!name)
+		return -1;
+	snprintf(path, size, "%s/%s/%s%0*d", bd->dir, name,
+		 idx < bd->k ? "k" : "m", bd->md,
+		 idx < bd->k ? idx + 1 : idx - bd->k + 1);
+	return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef _BLKDIR_H
+#define _BLKDIR_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+/* A received file as block directories dir/bN, each holding whichever
+ * of its chunk files kNN and mNN arrived and a bN_meta.txt file, with
+ * the padding of the last block in dir/padding.txt, as drink used to
+ * leave them. Every block has the same geometry.
+ */
+struct blkdir {
+	char		*dir;
+	char		**names;	/* NULL if never received. */
+	__u32		num_blocks;
+	int		k;
+	int		m;
+	int		chunk_size;
+	int		md;		/* Digits of chunk numbers. */
+	int		padding;
+};
+
+/* Find the blocks of @dir, and the geometry of the file in the meta file
+ * of the first one. Returns -1 if there are none or it is invalid; the
+ * directory must be closed either way.
+ */
+int blkdir_open(struct blkdir *bd, const char *dir);
+void blkdir_close(struct blkdir *bd);
+
+/* Write the path of chunk @idx of @block_id (0..k-1 for data, k..k+m-1
+ * for coding) to @path. Returns -1 if the block was never received.
+ */
+int blkdir_chunk_path(const struct blkdir *bd, __u32 block_id, int idx,
+		      char *path, size_t size);
+
+#endif /* _BLKDIR_H */
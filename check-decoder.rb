@@ -0,0 +1,92 @@
+#
+# check-decoder.rb: check that the decoder's memory does not grow with
+# the file
+#
+# Encode generated files of several sizes, erase some of their data
+# files, decode them within a small budget, and check that each output
+# matches its input and that the decoder's peak RSS stays within the
+# budget plus a fixed allowance for the rest of the process.
+#
+
+require "fileutils"
+require "tmpdir"
+
+ENCODER =	File.expand_path("./encoder")
+DECODER =	File.expand_path("./decoder")
+ENCODED_DIR =	"encoded"
+NAME =		"f"
+BLOCK =		"b"
+NUM_DATA_FILES = 10
+NUM_CODE_FILES = 10
+CODING_TECH =	"cauchy_good"
+WORD_SIZE =	8
+# A read-in of 256 blocks of 3840 bytes.
+BUFFER_SIZE =	983040
+ERASED =	["k01", "k04", "k10"]
+BUDGET_MB =	4
+SLACK_MB =	32
+SIZES_MB =	[1, 16, 256]
+PEAK_RSS =	Regexp.new('Peak RSS \(MB\): ([\d.]+)')
+
+USAGE =
+  "\nUsage:\n"                                                      \
+  "\truby check-decoder.rb [size-MB...]\n\n"                        \
+  "Sizes default to #{SIZES_MB.join(", ")}. The decoder gets a budget of " \
+  "#{BUDGET_MB} MB\nand may use #{SLACK_MB} MB more than that.\n\n"
+
+# Returns the peak RSS in MB of decoding a file of @size_mb MB, or nil
+# if the decode failed.
+def check(size_mb)
+  Dir.mktmpdir do |dir|
+    Dir.chdir(dir) do
+      input = File.join(dir, NAME)
+      rng = Random.new(size_mb)
+      File.open(input, "wb") do |f|
+        size_mb.times { f.write(rng.bytes(1 << 20)) }
+      end
+
+      block_dir = File.join(ENCODED_DIR, NAME, BLOCK)
+      FileUtils.mkdir_p(block_dir)
+      `#{ENCODER} #{input} #{NAME} #{BLOCK} #{NUM_DATA_FILES} \
+                  #{NUM_CODE_FILES} #{CODING_TECH} #{WORD_SIZE} 1 \
+                  #{BUFFER_SIZE} 2>&1`
+      return nil unless $?.success?
+      ERASED.each { |chunk| FileUtils.rm_f(File.join(block_dir, chunk)) }
+      FileUtils.mv(File.join(block_dir, "meta.txt"),
+                   File.join(block_dir, "#{BLOCK}_meta.txt"))
+
+      out = `#{DECODER} -M #{BUDGET_MB} #{File.join(ENCODED_DIR, NAME)} \
+                        #{BLOCK} 2>&1`
+      return nil unless $?.success? and
+                        FileUtils.compare_file(input,
+                                               File.join(block_dir,
+                                                         "#{BLOCK}_decoded"))
+      peak = out[PEAK_RSS, 1]
+      return peak && peak.to_f
+    end
+  end
+end
+
+if __FILE__ == $PROGRAM_NAME
+  sizes = ARGV.empty? ? SIZES_MB : ARGV.map(&:to_i)
+  if sizes.any? { |size| size <= 0 }
+    puts(USAGE)
+    exit(1)
+  end
+
+  failed = false
+  printf("%8s %14s\n", "file MB", "peak RSS MB")
+  sizes.each do |size|
+    peak = check(size)
+    if !peak
+      printf("%8d %14s\n", size, "decode failed")
+      failed = true
+    elsif peak > BUDGET_MB + SLACK_MB
+      printf("%8d %14.1f over %d MB\n", size, peak, BUDGET_MB + SLACK_MB)
+      failed = true
+    else
+      printf("%8d %14.1f\n", size, peak)
+    end
+  end
+  exit(failed ? 1 : 0)
+end
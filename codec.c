@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <string.h>
+#include <jerasure.h>
+#include <jerasure/cauchy.h>
+#include "codec.h"
+
+int codec_init(struct codec *codec, int k, int m)
+{
+	memset(codec, 0, sizeof(*codec));
+	codec->k = k;
+	codec->m = m;
+
+	codec->matrix = cauchy_good_general_coding_matrix(k, m,
+							  CODEC_WORD_SIZE);
+	if (!codec->matrix)
+		return -1;
+
+	codec->bitmatrix = jerasure_matrix_to_bitmatrix(k, m,
+		CODEC_WORD_SIZE, codec->matrix);
+	if (!codec->bitmatrix)
+		goto matrix;
+
+	codec->schedule = jerasure_smart_bitmatrix_to_schedule(k, m,
+		CODEC_WORD_SIZE, codec->bitmatrix);
+	if (!codec->schedule)
+		goto bitmatrix;
+
+	return 0;
+
+bitmatrix:
+	free(codec->bitmatrix);
+matrix:
+	free(codec->matrix);
+	return -1;
+}
+
+void codec_free(struct codec *codec)
+{
+	jerasure_free_schedule(codec->schedule);
+	free(codec->bitmatrix);
+	free(codec->matrix);
+}
+
+void codec_encode(const struct codec *codec, char **data, char **coding,
+		  int size)
+{
+	jerasure_schedule_encode(codec->k, codec->m, CODEC_WORD_SIZE,
+				 codec->schedule, data, coding, size,
+				 CODEC_PACKET_SIZE);
+}
+
+int codec_decode(const struct codec *codec, int *erasures, char **data,
+		 char **coding, int size)
+{
+	return jerasure_schedule_decode_lazy(codec->k, codec->m,
+					     CODEC_WORD_SIZE,
+					     codec->bitmatrix, erasures,
+					     data, coding, size,
+					     CODEC_PACKET_SIZE, 1);
+}
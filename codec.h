@@ -0,0 +1,36 @@
+#ifndef _CODEC_H
+#define _CODEC_H
+
+/* In-process access to the same Cauchy Reed-Solomon code that
+ * spray.rb asks ./encoder for and drink.rb asks ./decoder for:
+ * cauchy_good with w = 8 and a packet size of one word.
+ */
+#define CODEC_WORD_SIZE		8
+#define CODEC_PACKET_SIZE	1
+
+struct codec {
+	int	k;
+	int	m;
+	int	*matrix;
+	int	*bitmatrix;
+	int	**schedule;
+};
+
+int codec_init(struct codec *codec, int k, int m);
+void codec_free(struct codec *codec);
+
+/* @size is the length of each chunk and must be a multiple of
+ * CODEC_WORD_SIZE * CODEC_PACKET_SIZE * sizeof(long).
+ */
+void codec_encode(const struct codec *codec, char **data, char **coding,
+		  int size);
+
+/* @erasures lists the missing chunk indexes (data chunks are 0..k-1,
+ * coding chunks are k..k+m-1) and is terminated by -1. Missing chunks
+ * are rebuilt in place. Returns 0 on success and -1 if there are more
+ * than m erasures.
+ */
+int codec_decode(const struct codec *codec, int *erasures, char **data,
+		 char **coding, int size);
+
+#endif /* _CODEC_H */
@@ -73,9 +73,15 @@ same arguments, and encoder.c does error check.
 #include <jerasure/cauchy.h>
 #include <jerasure/liberation.h>
 #include "timing.h"
+#include "batchdec.h"
+#include "arena.h"
 
 #define N 10
 
+/* Default memory budget for the k+m window buffers */
+#define DEF_BUDGET_MB	64
+#define BUF_ALIGN	ARENA_PAGE_SIZE
+
 enum Coding_Technique {Reed_Sol_Van, Reed_Sol_R6_Op, Cauchy_Orig, Cauchy_Good, Liberation, Blaum_Roth, Liber8tion, RDP, EVENODD, No_Coding};
 
 char *Methods[N] = {"reed_sol_van", "reed_sol_r6_op", "cauchy_orig", "cauchy_good", "liberation", "blaum_roth", "liber8tion", "rdp", "evenodd", "no_coding"};
@@ -87,6 +93,23 @@ int readins, n;
 /* Function prototype */
 void ctrl_bs_handler(int dummy);
 
+/* Peak resident set size of the process in kB, or 0 if unknown */
+static long peak_rss_kb(void)
+{
+	char line[128];
+	long kb = 0;
+	FILE *fp = fopen("/proc/self/status", "r");
+
+	if (fp == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+			break;
+	}
+	fclose(fp);
+	return kb;
+}
+
 int main (int argc, char **argv) {
 	FILE *fp;				// File pointer
 
@@ -94,7 +117,6 @@ int main (int argc, char **argv) {
 	char **data;
 	char **coding;
 	int *erasures;
-	int *erased;
 	int *matrix;
 	int *bitmatrix;
 	
@@ -103,13 +125,20 @@ int main (int argc, char **argv) {
 	int tech;
 	char *c_tech;
 	
-	int i, j;				// loop control variable, s
-	int blocksize;			// size of individual files
-	int origsize;			// size of file before padding
-	int total;				// used to write data, not padding to file
+	int i;				// loop control variable, s
+	off_t blocksize;		// bytes of each file per read-in
+	long long origsize;		// size of file before padding
 	struct stat status;		// used to find size of individual files
 	int numerased;			// number of erased files
-        int dummy;
+	FILE **files;			// the k+m files, NULL if erased
+	off_t off, pos;			// offset in a read-in, in the output
+	size_t len, out_len;		// bytes of each file in a window
+	size_t window;			// bytes of each file decoded at once
+	size_t align;			// granularity of the code
+	double budget;			// bytes for the window buffers
+	long peak;			// peak RSS in kB
+	struct arena arena;		// the window buffers
+	char *buf;
 		
 	/* Used to recreate file names */
 	char *temp;
@@ -135,16 +164,30 @@ int main (int argc, char **argv) {
 	/* Start timing */
 	timing_set(&t1);
 
+	/* Decode a whole received file at once */
+	if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+		return batch_decode_main(argc - 1, argv + 1);
+	}
+
+	budget = DEF_BUDGET_MB;
+	if (argc > 2 && strcmp(argv[1], "-M") == 0) {
+		budget = atof(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	budget *= 1024 * 1024;
+
 	/* Error checking parameters */
-	if (argc != 3) {
-		fprintf(stderr, "usage: filename blockname\n");
+	if (argc != 3 || budget <= 0) {
+		fprintf(stderr, "usage: [-M budget-MB] filename blockname\n"
+				"       -b [-t threads] dir output-file\n");
 		exit(0);
 	}
 	curdir = (char *)malloc(sizeof(char)*100);
 	getcwd(curdir, 100);
 	
 	/* Begin recreation of file names */
-	cs1 = (char*)malloc(sizeof(char)*strlen(argv[1]));
+	cs1 = (char*)malloc(sizeof(char)*(strlen(argv[1])+1));
 	cs2 = strrchr(argv[1], '/');
 	if (cs2 != NULL) {
 		cs2++;
@@ -179,7 +222,7 @@ int main (int argc, char **argv) {
 		exit(0);
 	}
 	
-	if (fscanf(fp, "%d", &origsize) != 1) {
+	if (fscanf(fp, "%lld", &origsize) != 1) {
 		fprintf(stderr, "Original size is not valid\n");
 		exit(0);
 	}
@@ -203,24 +246,6 @@ int main (int argc, char **argv) {
 	}
 	fclose(fp);	
 
-	/* Allocate memory */
-	erased = (int *)malloc(sizeof(int)*(k+m));
-	for (i = 0; i < k+m; i++)
-		erased[i] = 0;
-	erasures = (int *)malloc(sizeof(int)*(k+m));
-
-	data = (char **)malloc(sizeof(char *)*k);
-	coding = (char **)malloc(sizeof(char *)*m);
-	if (buffersize != origsize) {
-		for (i = 0; i < k; i++) {
-			data[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-		}
-		for (i = 0; i < m; i++) {
-			coding[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-		}
-		blocksize = buffersize/k;
-	}
-
 	sprintf(temp, "%d", k);
 	md = strlen(temp);
 	timing_set(&t3);
@@ -254,126 +279,131 @@ int main (int argc, char **argv) {
 	}
 	timing_set(&t4);
 	totalsec += timing_delta(&t3, &t4);
-	
+
+	/* Open the k+m files once, and find the erasures */
+	files = (FILE **)malloc(sizeof(FILE *)*(k+m));
+	erasures = (int *)malloc(sizeof(int)*(k+m+1));
+	blocksize = buffersize != origsize ? buffersize/k : 0;
+	numerased = 0;
+	for (i = 0; i < k+m; i++) {
+		sprintf(fname, "%s/%s/%s/%c%0*d", curdir, filename, blockname,
+			i < k ? 'k' : 'm', md, i < k ? i+1 : i-k+1);
+		files[i] = fopen(fname, "rb");
+		if (files[i] == NULL) {
+			erasures[numerased] = i;
+			numerased++;
+			printf("%s failed: %s\n", fname, strerror(errno));
+		}
+		else if (blocksize == 0) {
+			fstat(fileno(files[i]), &status);
+			blocksize = status.st_size;
+		}
+	}
+	erasures[numerased] = -1;
+	if (numerased > m) {
+		fprintf(stderr, "Unsuccessful!\n");
+		exit(0);
+	}
+
+	/* Decode in windows of the same few bytes of every file, so that
+	   memory does not grow with the file. The code works on groups of
+	   w packets, so any window that is a multiple of them decodes the
+	   same as the whole read-in. */
+	align = sizeof(long)*w*(packetsize > 0 ? packetsize : 1);
+	window = (size_t)(budget/(k+m)) / align * align;
+	if (window < align)
+		window = align;
+	if ((off_t)window > blocksize)
+		window = blocksize;
+
+	/* All k+m window buffers come from a single region */
+	arena_init(&arena, (k+m)*(window + BUF_ALIGN), ARENA_F_HUGE);
+	data = (char **)malloc(sizeof(char *)*k);
+	coding = (char **)malloc(sizeof(char *)*m);
+	for (i = 0; i < k+m; i++) {
+		buf = arena_alloc_aligned(&arena, window, BUF_ALIGN);
+		if (buf == NULL) {
+			fprintf(stderr, "Unable to allocate %zu bytes\n", window);
+			exit(1);
+		}
+		if (i < k)
+			data[i] = buf;
+		else
+			coding[i-k] = buf;
+	}
+
+	/* Create decoded file */
+	sprintf(fname, "%s/%s/%s/%s_decoded", curdir,
+		 filename, blockname, blockname);
+	fp = fopen(fname, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Unable to create %s: %s\n", fname, strerror(errno));
+		exit(1);
+	}
+
 	/* Begin decoding process */
-	total = 0;
-	n = 1;	
+	n = 1;
 	while (n <= readins) {
-		numerased = 0;
-		/* Open files, check for erasures, read in data/coding */	
-		for (i = 1; i <= k; i++) {
-			sprintf(fname, "%s/%s/%s/k%0*d", curdir, filename,
-				blockname, md, i);
-			fp = fopen(fname, "rb");
-			if (fp == NULL) {
-				erased[i-1] = 1;
-				erasures[numerased] = i-1;
-				numerased++;
-				printf("%s failed: %s\n", fname, strerror(errno));
-			}
-			else {
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size;
-					data[i-1] = (char *)malloc(sizeof(char)*blocksize);
-					dummy = fread(data[i-1], sizeof(char), blocksize, fp);
-				}
-				else {
-					fseek(fp, blocksize*(n-1), SEEK_SET); 
-					dummy = fread(data[i-1], sizeof(char), buffersize/k, fp);
+		for (off = 0; off < blocksize; off += len) {
+			len = blocksize - off < (off_t)window ? (size_t)(blocksize - off) : window;
+			for (i = 0; i < k+m; i++) {
+				if (files[i] == NULL)
+					continue;
+				fseeko(files[i], blocksize*(n-1) + off, SEEK_SET);
+				if (fread(i < k ? data[i] : coding[i-k], sizeof(char),
+					  len, files[i]) != len) {
+					fprintf(stderr, "Short read of file %d\n", i);
+					exit(1);
 				}
-				fclose(fp);
 			}
-		}
-		for (i = 1; i <= m; i++) {
-			sprintf(fname, "%s/%s/%s/m%0*d", curdir, filename,
-				blockname, md, i);
-			fp = fopen(fname, "rb");
-			if (fp == NULL) {
-				erased[k+(i-1)] = 1;
-				erasures[numerased] = k+i-1;
-				numerased++;
-				printf("%s failed\n", fname);
-			}
-			else {
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size;
-					coding[i-1] = (char *)malloc(sizeof(char)*blocksize);
-					dummy = fread(coding[i-1], sizeof(char), blocksize, fp);
-				}
-				else {
-					fseek(fp, blocksize*(n-1), SEEK_SET);
-					dummy = fread(coding[i-1], sizeof(char), blocksize, fp);
-				}	
-				fclose(fp);
+			timing_set(&t3);
+
+			/* Choose proper decoding method */
+			if (numerased == 0) {
+				i = 0;
 			}
-		}
-		/* Finish allocating data/coding if needed */
-		if (n == 1) {
-			for (i = 0; i < numerased; i++) {
-				if (erasures[i] < k) {
-					data[erasures[i]] = (char *)malloc(sizeof(char)*blocksize);
-				}
-				else {
-					coding[erasures[i]-k] = (char *)malloc(sizeof(char)*blocksize);
-				}
+			else if (tech == Reed_Sol_Van || tech == Reed_Sol_R6_Op) {
+				i = jerasure_matrix_decode(k, m, w, matrix, 1, erasures, data, coding, len);
 			}
-		}
-		
-		erasures[numerased] = -1;
-		timing_set(&t3);
-	
-		/* Choose proper decoding method */
-		if (tech == Reed_Sol_Van || tech == Reed_Sol_R6_Op) {
-			i = jerasure_matrix_decode(k, m, w, matrix, 1, erasures, data, coding, blocksize);
-		}
-		else if (tech == Cauchy_Orig || tech == Cauchy_Good || tech == Liberation || tech == Blaum_Roth || tech == Liber8tion) {
-			i = jerasure_schedule_decode_lazy(k, m, w, bitmatrix, erasures, data, coding, blocksize, packetsize, 1);
-		}
-		else {
-			fprintf(stderr, "Not a valid coding technique.\n");
-			exit(0);
-		}
-		timing_set(&t4);
-	
-		/* Exit if decoding was unsuccessful */
-		if (i == -1) {
-			fprintf(stderr, "Unsuccessful!\n");
-			exit(0);
-		}
-		/* Create decoded file */
-		sprintf(fname, "%s/%s/%s/%s_decoded", curdir,
-			 filename, blockname, blockname);
-		if (n == 1) {
-			fp = fopen(fname, "wb");
-		}
-		else {
-			fp = fopen(fname, "ab");
-		}
-		for (i = 0; i < k; i++) {
-			if (total+blocksize <= origsize) {
-				fwrite(data[i], sizeof(char), blocksize, fp);
-				total+= blocksize;
+			else if (tech == Cauchy_Orig || tech == Cauchy_Good || tech == Liberation || tech == Blaum_Roth || tech == Liber8tion) {
+				i = jerasure_schedule_decode_lazy(k, m, w, bitmatrix, erasures, data, coding, len, packetsize, 1);
 			}
 			else {
-				for (j = 0; j < blocksize; j++) {
-					if (total < origsize) {
-						fprintf(fp, "%c", data[i][j]);
-						total++;
-					}
-					else {
-						break;
-					}
-					
-				}
+				fprintf(stderr, "Not a valid coding technique.\n");
+				exit(0);
+			}
+			timing_set(&t4);
+
+			/* Exit if decoding was unsuccessful */
+			if (i == -1) {
+				fprintf(stderr, "Unsuccessful!\n");
+				exit(0);
+			}
+
+			/* Data file i of read-in n goes after the data files
+			   before it, all but the padding */
+			for (i = 0; i < k; i++) {
+				pos = (blocksize*k)*(n-1) + blocksize*i + off;
+				if (pos >= origsize)
+					break;
+				out_len = origsize - pos < (off_t)len ? (size_t)(origsize - pos) : len;
+				fseeko(fp, pos, SEEK_SET);
+				fwrite(data[i], sizeof(char), out_len, fp);
 			}
+			totalsec += timing_delta(&t3, &t4);
 		}
 		n++;
-		fclose(fp);
-		totalsec += timing_delta(&t3, &t4);
 	}
-	
+	fclose(fp);
+
+	for (i = 0; i < k+m; i++) {
+		if (files[i] != NULL)
+			fclose(files[i]);
+	}
+	free(files);
+	arena_print_stats(stderr, "Buffers", &arena.stats);
+	arena_destroy(&arena);
+
 	/* Free allocated memory */
 	free(cs1);
 	free(extension);
@@ -381,13 +411,18 @@ int main (int argc, char **argv) {
 	free(data);
 	free(coding);
 	free(erasures);
-	free(erased);
 	
 	/* Stop timing and print time */
 	timing_set(&t2);
 	tsec = timing_delta(&t1, &t2);
 	printf("Decoding (MB/sec): %0.10f\n", (((double) origsize)/1024.0/1024.0)/totalsec);
-	printf("De_Total (MB/sec): %0.10f\n\n", (((double) origsize)/1024.0/1024.0)/tsec);
+	printf("De_Total (MB/sec): %0.10f\n", (((double) origsize)/1024.0/1024.0)/tsec);
+
+	/* The window buffers are all that grows with the budget; nothing
+	   should grow with the file, which make check verifies */
+	peak = peak_rss_kb();
+	printf("Peak RSS (MB): %0.1f, window %zu bytes per file\n\n",
+	       peak/1024.0, window);
 
 	return 0;
 }	
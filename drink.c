@@ -2,377 +2,1073 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include "fountain.h"
+#include "arena.h"
+#include "codec.h"
+#include "feedback.h"
+#include "journal.h"
+#include "recvmap.h"
 
 #define DECODED_DIR		"decoded"
 #define NAME_FILE		"name.txt"
 #define NAME_FILE_PATH		DECODED_DIR "/" NAME_FILE
-#define DATA_PREFIX		"k"
-#define CODE_PREFIX		"m"
-#define WORD_SIZE		8
-#define CODING_TECH		"cauchy_good"
+#define PART_EXT		".part"
+#define JOURNAL_EXT		".journal"
 
-#define USAGE	"usage:\t./drink cli_addr_file\n"
+#define DEF_DECODE_THREADS	1
+#define DEF_FEEDBACK_MS		250
 
-static int check_cli_params(int argc, char * const argv[])
+/* Senders that are told apart in the stats; chunks from any further
+ * ones are still kept.
+ */
+#define MAX_SOURCES		16
+
+#define USAGE	"usage:\t./drink [-t decode-threads] [-f feedback-ms] "\
+		"[-o -|host:port] cli_addr_file\n"
+
+static void create_name_file(const char *filename)
 {
-	UNUSED(argv);
-	if (argc != 2) {
-		printf(USAGE);
-		return 1;
+	/* Create file that holds received file's name. */
+	FILE *name_file = fopen(NAME_FILE_PATH, "wb");
+	assert(name_file);
+	fprintf(name_file, "%s", filename);
+	fclose(name_file);
+}
+
+/* Blocks that hold k chunks, waiting for a decode thread. Each block
+ * is queued at most once, so @ids never overflows.
+ */
+struct decode_queue {
+	pthread_mutex_t	lock;
+	pthread_cond_t	ready;
+	__u32		*ids;
+	__u32		head;
+	__u32		tail;
+	int		closed;
+};
+
+/* In-order output of complete blocks to a pipe or socket. A complete
+ * block waits in the output file until every block before it is
+ * written out. Protected by the lock of the decode queue.
+ */
+struct stream {
+	int		fd;		/* -1 if not streaming. */
+	__u8		*ready;		/* Of every block. */
+	__u32		next;		/* Next block to write out. */
+	unsigned int	held;		/* Ready, not yet written out. */
+	unsigned int	max_held;	/* While @next was not ready. */
+	int		writing;
+};
+
+/* A sender of the file, such as one of several mirrors. */
+struct source {
+	struct tmp_sockaddr_storage	addr;
+	socklen_t			addr_len;
+	unsigned long			packets;
+	unsigned long			chunks;		/* Kept. */
+	struct fountain_report		report;		/* For rate control. */
+	double				last_arrival;
+};
+
+/* Data chunks are written once, straight to their place in the output
+ * file. Only the coding chunks of incomplete blocks are kept in memory,
+ * for the blocks that turn out to miss data chunks, in buffers that the
+ * receive thread takes from @coding_pool and the decode threads put
+ * back.
+ *
+ * What the file holds is logged in a journal next to it, so that a
+ * transfer that is cut short resumes where it stopped.
+ */
+struct recv_file {
+	char			*filename;
+	char			*file_path;
+	char			*part_path;	/* Until it is complete. */
+	char			*journal_path;
+	int			fd;
+	struct journal		journal;
+	int			resumed;
+	unsigned long		resumed_chunks;
+	__u32			num_blocks;
+	__u16			padding;
+	__u32			session;
+	struct recvmap		map;
+	__u8			**coding;
+	struct pool		coding_pool;
+	struct codec		codec;
+	struct decode_queue	q;
+	struct stream		out;
+	/* Protected by @q.lock. */
+	__u32			blocks_written;
+	__u32			blocks_decoded;
+	int			failed;
+	double			last_written;
+	struct arena_stats	scratch;	/* Of the decode threads. */
+	/* Of the receive thread. */
+	struct source		sources[MAX_SOURCES];
+	unsigned int		num_sources;
+	unsigned long		foreign;	/* Of other files, or runts. */
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void decode_queue_push(struct decode_queue *q, __u32 block_id)
+{
+	assert(!pthread_mutex_lock(&q->lock));
+	q->ids[q->tail++] = block_id;
+	assert(!pthread_cond_signal(&q->ready));
+	assert(!pthread_mutex_unlock(&q->lock));
+}
+
+/* Returns -1 once the queue is closed and empty. */
+static int decode_queue_pop(struct decode_queue *q, __u32 *block_id)
+{
+	int rc = 0;
+
+	assert(!pthread_mutex_lock(&q->lock));
+	while (q->head == q->tail && !q->closed)
+		assert(!pthread_cond_wait(&q->ready, &q->lock));
+	if (q->head == q->tail)
+		rc = -1;
+	else
+		*block_id = q->ids[q->head++];
+	assert(!pthread_mutex_unlock(&q->lock));
+	return rc;
+}
+
+static void decode_queue_close(struct decode_queue *q)
+{
+	assert(!pthread_mutex_lock(&q->lock));
+	q->closed = 1;
+	assert(!pthread_cond_broadcast(&q->ready));
+	assert(!pthread_mutex_unlock(&q->lock));
+}
+
+static int pwrite_all(struct recv_file *rf, const void *buf, size_t len,
+		      off_t off)
+{
+	ssize_t rc = pwrite(rf->fd, buf, len, off);
+
+	if (rc != (ssize_t)len) {
+		fprintf(stderr, "%s: pwrite errno=%i on %s: %s\n",
+			__func__, errno, rf->part_path, strerror(errno));
+		return -1;
 	}
 	return 0;
 }
 
-void create_block_dirs(const char *filename, __u32 num_blocks)
+static int pread_block(struct recv_file *rf, __u32 block_id, __u8 *buf)
 {
-	char *block_path, *decoded_file_path;
-	int alloc_len, len, rc;
-	__u32 i;
-	int n_digits = num_digits(num_blocks - 1);
+	ssize_t rc = pread(rf->fd, buf, BLOCK_SIZE,
+			   (off_t)block_id * BLOCK_SIZE);
 
-	/* Create directory for decoded file. */
-	len = asprintf(&decoded_file_path, "%s/%s", DECODED_DIR,
-		       filename);
-	if (len == -1) {
-		fprintf(stderr,
-			"asprintf: cannot allocate file path string\n");
-		return;
+	if (rc != BLOCK_SIZE) {
+		fprintf(stderr, "%s: pread errno=%i on %s: %s\n",
+			__func__, errno, rf->part_path, strerror(errno));
+		return -1;
 	}
+	return 0;
+}
 
-	if (file_exists(decoded_file_path))
-		/* Remove existing file. */
-		remove(decoded_file_path);
+static int write_all(int fd, const __u8 *buf, size_t len)
+{
+	ssize_t rc;
 
-	rc = mkdir(decoded_file_path, 0777);
-	if (rc < 0) {
-		fprintf(stderr, "%s: mkdir errno=%i on %s: %s\n",
-			__func__, errno, decoded_file_path, strerror(errno));
-		exit(1);
+	while (len) {
+		rc = write(fd, buf, len);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0) {
+			fprintf(stderr, "%s: write errno=%i: %s\n",
+				__func__, errno, strerror(errno));
+			return -1;
+		}
+		buf += rc;
+		len -= rc;
 	}
+	return 0;
+}
 
-	/* asprintf returns the number of bytes printed, not the
-	 * number of bytes allocated, so we must add one for the
-	 * terminating null byte since we're going to reuse
-	 * the @block_path allocated memory.
-	 */
+/* Write out every complete block that follows the ones already written,
+ * without the padding of the last block. Only one thread writes at a
+ * time; the others leave their blocks to it.
+ */
+static int stream_blocks(struct recv_file *rf, __u8 *buf)
+{
+	struct stream *out = &rf->out;
+	int rc = 0;
 
-	/* Create directories for separate decoded blocks. */
-	len = asprintf(&block_path, "%s/%s/b%0*d", DECODED_DIR,
-		       filename, n_digits, 0);
-	if (len == -1) {
-		fprintf(stderr,
-			"asprintf: cannot allocate file path string\n");
-		return;
+	assert(!pthread_mutex_lock(&rf->q.lock));
+	if (out->writing) {
+		assert(!pthread_mutex_unlock(&rf->q.lock));
+		return 0;
 	}
-	alloc_len = len + 1;
-	rc = mkdir(block_path, 0777);
-	if (rc < 0) {
-		fprintf(stderr, "%s: mkdir errno=%i on %s: %s\n",
-			__func__, errno, block_path, strerror(errno));
-		exit(1);
+	out->writing = 1;
+	while (!rc && !rf->failed && out->next < rf->num_blocks &&
+	       out->ready[out->next]) {
+		__u32 block_id = out->next;
+		size_t len = BLOCK_SIZE;
+
+		if (block_id == rf->num_blocks - 1)
+			len -= rf->padding;
+		assert(!pthread_mutex_unlock(&rf->q.lock));
+		rc = pread_block(rf, block_id, buf);
+		if (!rc)
+			rc = write_all(out->fd, buf, len);
+		assert(!pthread_mutex_lock(&rf->q.lock));
+		out->held--;
+		out->next++;
 	}
+	out->writing = 0;
+	assert(!pthread_mutex_unlock(&rf->q.lock));
+	return rc;
+}
 
-	for (i = 1; i < num_blocks; i++) {
-		/* Use same buffer up to @alloc_len bytes. We
-		 * will never need more space than that.
-		 */
-		len = snprintf(block_path, alloc_len, "%s/%s/b%0*d",
-			       DECODED_DIR, filename, n_digits, i);
-		if (len < 0) {
-			fprintf(stderr,
-				"snprintf: cannot allocate file path\n");
-			exit(1);
+/* Rebuild any missing data chunks of @block_id in place in the output
+ * file, using @buf as scratch space, and stream the block out.
+ */
+static int decode_block(struct recv_file *rf, __u32 block_id, __u8 *buf)
+{
+	__u8 *coding_chunks = rf->coding[block_id];
+	__u32 recv_mask = recvmap_mask(&rf->map, block_id);
+	char *data[DATA_FILES_PER_BLOCK];
+	char *coding[CODE_FILES_PER_BLOCK];
+	int erasures[CHUNKS_PER_BLOCK + 1];
+	int i, num_erased = 0, data_erased = 0;
+	off_t off = (off_t)block_id * BLOCK_SIZE;
+
+	for (i = 0; i < CHUNKS_PER_BLOCK; i++) {
+		if (i < DATA_FILES_PER_BLOCK)
+			data[i] = (char *)buf + i * CHUNK_SIZE;
+		else if (coding_chunks)
+			coding[i - DATA_FILES_PER_BLOCK] =
+				(char *)coding_chunks +
+				(i - DATA_FILES_PER_BLOCK) * CHUNK_SIZE;
+
+		if (!(recv_mask & (1U << i))) {
+			erasures[num_erased++] = i;
+			if (i < DATA_FILES_PER_BLOCK)
+				data_erased = 1;
 		}
-		rc = mkdir(block_path, 0777);
-		if (rc < 0) {
-			fprintf(stderr, "%s: mkdir errno=%i on %s: %s\n",
-				__func__, errno, block_path, strerror(errno));
-			exit(1);
+	}
+	erasures[num_erased] = -1;
+
+	if (data_erased) {
+		/* The data chunks that arrived are in the output file. */
+		if (pread_block(rf, block_id, buf))
+			return -1;
+		if (codec_decode(&rf->codec, erasures, data, coding,
+				 CHUNK_SIZE) < 0) {
+			fprintf(stderr, "Cannot decode block %u\n", block_id);
+			return -1;
 		}
+		for (i = 0; i < DATA_FILES_PER_BLOCK; i++)
+			if (!(recv_mask & (1U << i)) &&
+			    pwrite_all(rf, data[i], CHUNK_SIZE,
+				       off + i * CHUNK_SIZE))
+				return -1;
+		if (journal_add(&rf->journal, block_id, JOURNAL_DECODED, 0,
+				NULL, 0))
+			return -1;
+	}
+	if (coding_chunks)
+		pool_put(&rf->coding_pool, coding_chunks);
+	rf->coding[block_id] = NULL;
+
+	assert(!pthread_mutex_lock(&rf->q.lock));
+	rf->blocks_written++;
+	rf->blocks_decoded += data_erased;
+	rf->last_written = now();
+	if (rf->out.fd >= 0) {
+		rf->out.ready[block_id] = 1;
+		rf->out.held++;
+		if (!rf->out.ready[rf->out.next] &&
+		    rf->out.held > rf->out.max_held)
+			rf->out.max_held = rf->out.held;
 	}
+	assert(!pthread_mutex_unlock(&rf->q.lock));
+
+	return rf->out.fd < 0 ? 0 : stream_blocks(rf, buf);
 }
 
-static void create_name_file(const char *filename)
+static void *decode_thread(void *arg)
 {
-	/* Create file that holds received file's name. */
-	FILE *name_file = fopen(NAME_FILE_PATH, "wb");
-	assert(name_file);
-	fprintf(name_file, "%s", filename);
-	fclose(name_file);
+	struct recv_file *rf = arg;
+	struct arena arena;
+	__u32 block_id;
+	__u8 *buf;
+
+	arena_init(&arena, BLOCK_SIZE, 0);
+	buf = arena_alloc(&arena, BLOCK_SIZE);
+	assert(buf);
+	while (!decode_queue_pop(&rf->q, &block_id)) {
+		if (decode_block(rf, block_id, buf)) {
+			assert(!pthread_mutex_lock(&rf->q.lock));
+			rf->failed = 1;
+			assert(!pthread_mutex_unlock(&rf->q.lock));
+		}
+	}
+
+	assert(!pthread_mutex_lock(&rf->q.lock));
+	arena_stats_add(&rf->scratch, &arena.stats);
+	assert(!pthread_mutex_unlock(&rf->q.lock));
+	arena_destroy(&arena);
+	return NULL;
 }
 
-static void create_padding_file(const char *filename, __u16 padding)
+/* Keep coding chunk @idx of @block_id until the block is decoded. */
+static int store_coding(struct recv_file *rf, __u32 block_id, int idx,
+			const void *chunk)
 {
-	FILE *padding_file;
-	char *padding_file_path;
-	int size = asprintf(&padding_file_path, "%s/%s/padding.txt",
-			    DECODED_DIR, filename);
-	if (size == -1) {
-		fprintf(stderr,
-			"asprintf: cannot allocate padding file path\n");
-		return;
+	if (!rf->coding[block_id]) {
+		rf->coding[block_id] = pool_get(&rf->coding_pool);
+		if (!rf->coding[block_id]) {
+			fprintf(stderr, "pool_get: cannot allocate block %u\n",
+				block_id);
+			return -1;
+		}
 	}
-	padding_file = fopen(padding_file_path, "wb");
-	assert(padding_file);
-	fprintf(padding_file, "%hd", padding);
-	fclose(padding_file);
+	memcpy(rf->coding[block_id] + (idx - DATA_FILES_PER_BLOCK) * CHUNK_SIZE,
+	       chunk, CHUNK_SIZE);
+	return 0;
 }
 
-static int write_data_to_file(const char *file_path, const __u8 *data,
-			      int num_bytes)
+/* Place the chunk in @fountain_hdr unless its block already holds it or
+ * is complete, log it, and hand the block to the decode threads as soon
+ * as it holds k chunks. Returns 1 if the chunk was kept, 0 if it was
+ * dropped, or -1 on error.
+ */
+static int recv_chunk(struct recv_file *rf,
+		      const struct fountain_hdr *fountain_hdr,
+		      unsigned int num_read)
 {
-	FILE *f = fopen(file_path, "wb");
+	__u32 block_id = ntohl(fountain_hdr->block_id);
+	__u16 packet_len = ntohs(fountain_hdr->packet_len);
+	int idx = recvmap_index(ntohs(fountain_hdr->chunk_id));
+	enum recvmap_result res;
+
+	if (block_id >= rf->num_blocks || idx < 0 ||
+	    packet_len != num_read ||
+	    packet_len - sizeof(*fountain_hdr) != CHUNK_SIZE) {
+		fprintf(stderr, "Dropping malformed packet\n");
+		return 0;
+	}
+
+	res = recvmap_add(&rf->map, block_id, idx);
+	if (res == RECVMAP_DUP)
+		return 0;
+
+	if (idx < DATA_FILES_PER_BLOCK) {
+		/* The chunk is on its way to the disk before its record. */
+		if (pwrite_all(rf, fountain_hdr->data, CHUNK_SIZE,
+			       (off_t)block_id * BLOCK_SIZE +
+			       idx * CHUNK_SIZE) ||
+		    journal_add(&rf->journal, block_id, JOURNAL_CHUNK, idx,
+				NULL, 0))
+			return -1;
+	} else {
+		/* Only the journal keeps coding chunks across a restart. */
+		if (store_coding(rf, block_id, idx, fountain_hdr->data) ||
+		    journal_add(&rf->journal, block_id, JOURNAL_CHUNK, idx,
+				fountain_hdr->data, CHUNK_SIZE))
+			return -1;
+	}
+
+	if (res == RECVMAP_COMPLETE)
+		decode_queue_push(&rf->q, block_id);
+	return 1;
+}
+
+/* Open the output file, at its full size up front, so that chunks can
+ * be written to it in any order without growing it. Returns 1 if it
+ * already had its full size, as left by an earlier run, 0 if it was
+ * created, or -1 on error.
+ */
+static int open_part_file(struct recv_file *rf)
+{
+	off_t size = (off_t)rf->num_blocks * BLOCK_SIZE;
+	struct stat st;
 	int rc;
-	assert(f);
-	rc = fwrite(data, sizeof(char), num_bytes, f);
-	fclose(f);
-	return rc;
+
+	rc = mkdir(DECODED_DIR, 0777);
+	if (rc < 0 && errno != EEXIST) {
+		fprintf(stderr, "%s: mkdir errno=%i on %s: %s\n",
+			__func__, errno, DECODED_DIR, strerror(errno));
+		return -1;
+	}
+
+	rf->fd = open(rf->part_path, O_RDWR | O_CREAT, 0666);
+	if (rf->fd < 0) {
+		fprintf(stderr, "%s: open errno=%i on %s: %s\n",
+			__func__, errno, rf->part_path, strerror(errno));
+		return -1;
+	}
+	if (!fstat(rf->fd, &st) && st.st_size == size)
+		return 1;
+
+	rc = ftruncate(rf->fd, 0);
+	if (!rc)
+		rc = fallocate(rf->fd, 0, 0, size);
+	if (rc < 0 && (errno == EOPNOTSUPP || errno == ENOSYS))
+		/* Fall back to a sparse file. */
+		rc = ftruncate(rf->fd, size);
+	if (rc < 0) {
+		fprintf(stderr, "%s: fallocate errno=%i on %s: %s\n",
+			__func__, errno, rf->part_path, strerror(errno));
+		close(rf->fd);
+		return -1;
+	}
+	return 0;
 }
 
-static int write_meta_data_to_file(const char *meta_file_path,
-	const char *filename, __u32 num_blocks, __u32 block_id,
-	unsigned int chunk_size)
-{ 
-	FILE *meta_file = fopen(meta_file_path, "wb");
+/* Rebuild what the file held from a record of its journal. */
+static void replay_record(void *arg, const struct journal_rec *rec,
+			  const void *payload)
+{
+	struct recv_file *rf = arg;
+	__u32 block_id = rec->block_id;
+
+	if (block_id >= rf->num_blocks || rec->idx >= CHUNKS_PER_BLOCK)
+		return;
+
+	switch (rec->type) {
+	case JOURNAL_CHUNK:
+		if (rec->idx >= DATA_FILES_PER_BLOCK && rec->len != CHUNK_SIZE)
+			break;
+		if (recvmap_add(&rf->map, block_id, rec->idx) == RECVMAP_DUP)
+			break;
+		rf->resumed_chunks++;
+		if (rec->idx >= DATA_FILES_PER_BLOCK &&
+		    store_coding(rf, block_id, rec->idx, payload))
+			rf->failed = 1;
+		break;
+	case JOURNAL_DECODED:
+		/* The block is whole in the output file. */
+		recvmap_set_data(&rf->map, block_id);
+		if (rf->coding[block_id]) {
+			pool_put(&rf->coding_pool, rf->coding[block_id]);
+			rf->coding[block_id] = NULL;
+		}
+		break;
+	}
+}
+
+/* Open the journal of the file, resuming an earlier transfer of it if
+ * the output file is still there. Returns -1 on error.
+ */
+static int open_journal(struct recv_file *rf, int part_whole)
+{
+	struct journal_hdr hdr;
 	int rc;
-	assert(meta_file);
-	rc = fprintf(meta_file,
-		     "%s/%s/b%0*d\n%u\n%d %d %d %d %u\n%s\n%d\n%d\n",
-		     DECODED_DIR, filename, num_digits(num_blocks - 1),
-		     block_id, chunk_size, DATA_FILES_PER_BLOCK,
-		     CODE_FILES_PER_BLOCK, WORD_SIZE, 1, chunk_size,
-		     CODING_TECH, 3, 1);
-	fclose(meta_file);
-	return rc;
+
+	/* The chunks that a journal without its file lists are gone. */
+	if (!part_whole && unlink(rf->journal_path) < 0 && errno != ENOENT) {
+		fprintf(stderr, "%s: unlink errno=%i on %s: %s\n",
+			__func__, errno, rf->journal_path, strerror(errno));
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic));
+	snprintf(hdr.filename, sizeof(hdr.filename), "%s", rf->filename);
+	hdr.num_blocks = rf->num_blocks;
+	hdr.padding = rf->padding;
+	hdr.chunk_size = CHUNK_SIZE;
+	hdr.k = DATA_FILES_PER_BLOCK;
+	hdr.m = CODE_FILES_PER_BLOCK;
+	hdr.session = rf->session;
+	rc = journal_open(&rf->journal, rf->journal_path, &hdr, rf->fd,
+			  replay_record, rf);
+	if (rc < 0)
+		return -1;
+	rf->resumed = rc;
+
+	/* Make the new files themselves survive a crash. */
+	rc = open(DECODED_DIR, O_RDONLY | O_DIRECTORY);
+	if (rc >= 0) {
+		fsync(rc);
+		close(rc);
+	}
+	return 0;
 }
 
-static inline int create_file_path(char *file_path, int alloc_len,
-				   const char *filename,
-				   __u32 num_blocks, __u32 block_id,
-				   __s16 chunk_id, __u16 chunk_id_abs)
+/* With @out_fd >= 0, complete blocks are also written out to @out_fd
+ * in order.
+ */
+static int open_recv_file(struct recv_file *rf,
+			  const struct fountain_hdr *fountain_hdr,
+			  int out_fd)
 {
-	return snprintf(file_path, alloc_len, "%s/%s/b%0*d/%s%0*d",
-			DECODED_DIR, filename,
-			num_digits(num_blocks - 1), block_id,
-			chunk_id > 0 ? DATA_PREFIX : CODE_PREFIX,
-			chunk_id > 0 ? num_digits(DATA_FILES_PER_BLOCK) :
-				       num_digits(CODE_FILES_PER_BLOCK),
-			chunk_id_abs);
+	int rc;
+
+	memset(rf, 0, sizeof(*rf));
+	rf->num_blocks = ntohl(fountain_hdr->num_blocks);
+	rf->padding = ntohs(fountain_hdr->padding);
+	rf->session = ntohl(fountain_hdr->session);
+	rf->out.fd = out_fd;
+
+	if (!rf->num_blocks || rf->padding >= BLOCK_SIZE) {
+		fprintf(stderr, "Invalid header\n");
+		return -1;
+	}
+
+	if (asprintf(&rf->filename, "%.*s", FILENAME_MAX_LEN,
+		     fountain_hdr->filename) == -1) {
+		fprintf(stderr,
+			"asprintf: cannot allocate filename\n");
+		return -1;
+	}
+	if (asprintf(&rf->file_path, "%s/%s", DECODED_DIR,
+		     rf->filename) == -1) {
+		fprintf(stderr, "asprintf: cannot allocate file path\n");
+		goto filename;
+	}
+	if (asprintf(&rf->part_path, "%s%s", rf->file_path,
+		     PART_EXT) == -1) {
+		fprintf(stderr, "asprintf: cannot allocate file path\n");
+		goto file_path;
+	}
+	if (asprintf(&rf->journal_path, "%s%s", rf->file_path,
+		     JOURNAL_EXT) == -1) {
+		fprintf(stderr, "asprintf: cannot allocate file path\n");
+		goto part_path;
+	}
+
+	rf->coding = calloc(rf->num_blocks, sizeof(*rf->coding));
+	rf->q.ids = malloc(rf->num_blocks * sizeof(*rf->q.ids));
+	if (out_fd >= 0)
+		rf->out.ready = calloc(rf->num_blocks,
+				       sizeof(*rf->out.ready));
+	if (recvmap_init(&rf->map, rf->num_blocks) || !rf->coding ||
+	    !rf->q.ids || (out_fd >= 0 && !rf->out.ready)) {
+		fprintf(stderr, "Cannot allocate the state of %u blocks\n",
+			rf->num_blocks);
+		goto state;
+	}
+
+	if (codec_init(&rf->codec, DATA_FILES_PER_BLOCK,
+		       CODE_FILES_PER_BLOCK)) {
+		fprintf(stderr, "codec_init: cannot create coding matrix\n");
+		goto state;
+	}
+
+	rc = open_part_file(rf);
+	if (rc < 0)
+		goto codec;
+
+	pool_init(&rf->coding_pool, CODE_FILES_PER_BLOCK * CHUNK_SIZE, 0,
+		  ARENA_F_HUGE);
+	if (open_journal(rf, rc))
+		goto pool;
+	assert(!pthread_mutex_init(&rf->q.lock, NULL));
+	assert(!pthread_cond_init(&rf->q.ready, NULL));
+	return 0;
+
+pool:
+	pool_destroy(&rf->coding_pool);
+	close(rf->fd);
+codec:
+	codec_free(&rf->codec);
+state:
+	recvmap_free(&rf->map);
+	free(rf->out.ready);
+	free(rf->q.ids);
+	free(rf->coding);
+	free(rf->journal_path);
+part_path:
+	free(rf->part_path);
+file_path:
+	free(rf->file_path);
+filename:
+	free(rf->filename);
+	return -1;
 }
 
-static inline int create_meta_file_path(char *file_path, int alloc_len,
-					const char *filename,
-					__u32 num_blocks, __u32 block_id)
+static void close_recv_file(struct recv_file *rf)
 {
-	return snprintf(file_path, alloc_len, "%s/%s/b%0*d/b%0*d_meta.txt",
-			DECODED_DIR, filename,
-			num_digits(num_blocks - 1), block_id,
-			num_digits(num_blocks - 1), block_id);
+	journal_close(&rf->journal);
+	assert(!close(rf->fd));
+	codec_free(&rf->codec);
+	assert(!pthread_cond_destroy(&rf->q.ready));
+	assert(!pthread_mutex_destroy(&rf->q.lock));
+	free(rf->q.ids);
+	/* Takes the buffers of incomplete blocks along. */
+	pool_destroy(&rf->coding_pool);
+	free(rf->coding);
+	free(rf->out.ready);
+	recvmap_free(&rf->map);
+	free(rf->journal_path);
+	free(rf->part_path);
+	free(rf->file_path);
+	free(rf->filename);
 }
 
-static void recv_file(int s)
+/* Strip the padding that the sender added to the last block and give
+ * the complete file its name.
+ */
+static int finish_file(struct recv_file *rf)
 {
-	struct tmp_sockaddr_storage srv;
-	socklen_t srv_len;
+	off_t file_size = (off_t)rf->num_blocks * BLOCK_SIZE - rf->padding;
 
-	char *recv_file_path, *meta_file_path;
+	if (ftruncate(rf->fd, file_size) < 0) {
+		fprintf(stderr, "%s: ftruncate errno=%i on %s: %s\n",
+			__func__, errno, rf->part_path, strerror(errno));
+		return -1;
+	}
+	if (rename(rf->part_path, rf->file_path) < 0) {
+		fprintf(stderr, "%s: rename errno=%i on %s: %s\n",
+			__func__, errno, rf->file_path, strerror(errno));
+		return -1;
+	}
+	/* Nothing is left to resume. */
+	unlink(rf->journal_path);
+	return 0;
+}
 
-	/* Variables that hold fountain header data. */
-	struct fountain_hdr *fountain_hdr;
-	__u32 num_blocks;
-	__u32 block_id;
-	__s16 chunk_id;
-	__u16 chunk_id_abs;
-	__u16 packet_len;
-	__u16 padding;
-	char *filename;
-
-	unsigned int pkt_len, num_read;
-	int file_path_alloc_len, meta_path_alloc_len, size, rc;
-	__u32 blocks_filled = 0, num_written;
-	__u16 *num_recv_in_block;
-
-	/* Read how many bytes are in the packet. */
-	pkt_len = recvfrom(s, NULL, 0, MSG_PEEK | MSG_TRUNC, NULL, NULL);
-	assert(pkt_len > sizeof(*fountain_hdr));
-
-	fountain_hdr = alloca(pkt_len);
-	srv_len = sizeof(srv);
-	num_read = recvfrom(s, fountain_hdr, pkt_len, 0,
-			    (struct sockaddr *)&srv, &srv_len);
-	assert(pkt_len == num_read);
+/* Hand the blocks that were complete before a restart to the decode
+ * threads.
+ */
+static void resume_blocks(struct recv_file *rf)
+{
+	__u32 i;
 
-	fprintf(stderr, "Receiving packets...\n");
+	for (i = 0; i < rf->num_blocks; i++)
+		if (recvmap_done(&rf->map, i))
+			decode_queue_push(&rf->q, i);
+	fprintf(stderr, "Resumed from %s: %lu chunks, %u of %u blocks "
+		"complete\n", rf->journal_path, rf->resumed_chunks,
+		rf->map.num_done, rf->num_blocks);
+}
 
-	num_blocks = ntohl(fountain_hdr->num_blocks);
-	block_id = ntohl(fountain_hdr->block_id);
-	chunk_id = ntohs(fountain_hdr->chunk_id);
-	chunk_id_abs = chunk_id < 0 ? -chunk_id : chunk_id;
-	packet_len = ntohs(fountain_hdr->packet_len);
-	padding = ntohs(fountain_hdr->padding);
+/* Tell the @n senders from @src on which blocks are complete, so that
+ * they skip them if they were started with -F.
+ */
+static void send_done(struct recv_file *rf, int s, const struct source *src,
+		      unsigned int n)
+{
+	struct feedback_msg msg;
+	__u32 i;
 
-	size = asprintf(&filename, "%s", fountain_hdr->filename);
-	if (size == -1) {
-		fprintf(stderr,
-			"asprintf: cannot allocate filename\n");
+	feedback_msg_init(&msg, rf->filename);
+	for (i = 0; i < rf->num_blocks; i++)
+		if (recvmap_done(&rf->map, i))
+			feedback_msg_add(&msg, i);
+	if (!msg.num_runs)
 		return;
+	for (i = 0; i < n; i++)
+		feedback_msg_send(&msg, s,
+				  (const struct sockaddr *)&src[i].addr,
+				  src[i].addr_len);
+}
+
+/* Tell every sender which blocks are complete, and how many of its
+ * packets got through for its rate control.
+ */
+static void send_feedback(struct recv_file *rf, int s)
+{
+	double t = now();
+	struct source *src;
+	unsigned int i;
+
+	send_done(rf, s, rf->sources, rf->num_sources);
+	for (i = 0; i < rf->num_sources; i++) {
+		src = &rf->sources[i];
+		src->report.hold_us = (t - src->last_arrival) * 1000000;
+		feedback_send_report(s, (const struct sockaddr *)&src->addr,
+				     src->addr_len, rf->filename,
+				     &src->report);
 	}
+}
 
-	/* Create directories to hold received file. */
-	create_block_dirs(filename, num_blocks);
+/* Returns the sender at @addr, which is added if it is new, or NULL if
+ * there are too many senders to tell apart.
+ */
+static struct source *find_source(struct recv_file *rf, int s,
+				  const struct tmp_sockaddr_storage *addr,
+				  socklen_t addr_len)
+{
+	struct source *src;
+	unsigned int i;
 
-	/* Create meta file with filename so that decoder knows
-	 * what name to give the received file.
-	 */
-	create_name_file(filename);
-
-	/* Create meta file that holds the received file's padding. */
-	create_padding_file(filename, padding);
-
-	/* Create file from first received packet. */
-	size = asprintf(&recv_file_path, "%s/%s/b%0*d/%s%0*d", DECODED_DIR,
-			filename, num_digits(num_blocks - 1), block_id,
-			chunk_id > 0 ? DATA_PREFIX : CODE_PREFIX,
-			chunk_id > 0 ? num_digits(DATA_FILES_PER_BLOCK) :
-				       num_digits(CODE_FILES_PER_BLOCK),
-			chunk_id_abs);
-	if (size == -1) {
-		fprintf(stderr, "asprintf: cannot allocate file path\n");
-		return;
+	for (i = 0; i < rf->num_sources; i++) {
+		src = &rf->sources[i];
+		if (address_match((const struct sockaddr *)&src->addr,
+				  src->addr_len,
+				  (const struct sockaddr *)addr, addr_len))
+			return src;
 	}
-	file_path_alloc_len = size + 1;
+	if (rf->num_sources == MAX_SOURCES)
+		return NULL;
 
-	/* Write the packet to a file, keep track of how many packets
-	 * we have received and which blocks they belong to.
+	src = &rf->sources[rf->num_sources++];
+	memcpy(&src->addr, addr, addr_len);
+	src->addr_len = addr_len;
+	if (rf->num_sources > 1)
+		fprintf(stderr, "Receiving from source %u\n", rf->num_sources);
+	/* A sender that joins late, or after a restart, need not send
+	 * what is complete already.
 	 */
-	num_written = write_data_to_file(recv_file_path, fountain_hdr->data,
-					 packet_len - sizeof(*fountain_hdr));
-	if (num_written != packet_len - sizeof(*fountain_hdr)) {
-		fprintf(stderr, "fwrite: cannot write packet to file\n");
-		return;
+	send_done(rf, s, src, 1);
+	return src;
+}
+
+/* Ask @src for the chunks that incomplete blocks are missing, lowest
+ * blocks first.
+ */
+static void send_nacks(struct recv_file *rf, int s, const struct source *src)
+{
+	struct nack_msg msg;
+	__u32 i;
+
+	nack_msg_init(&msg, rf->filename);
+	for (i = 0; i < rf->num_blocks; i++)
+		if (!recvmap_done(&rf->map, i) &&
+		    nack_msg_add(&msg, i, recvmap_mask(&rf->map, i)))
+			break;
+	fprintf(stderr, "Asking for repair of %u blocks\n",
+		rf->num_blocks - rf->map.num_done);
+	nack_msg_send(&msg, s, (const struct sockaddr *)&src->addr,
+		      src->addr_len);
+}
+
+static int wait_packet(int s, double secs)
+{
+	struct timeval timeout;
+	fd_set readfds;
+	int rc;
+
+	timeout.tv_sec = secs;
+	timeout.tv_usec = (secs - timeout.tv_sec) * 1000000;
+	FD_ZERO(&readfds);
+	FD_SET(s, &readfds);
+	rc = select(s + 1, &readfds, NULL, NULL, &timeout);
+	assert(rc >= 0);
+	return rc;
+}
+
+/* Wait for the next packet, NACKing the missing chunks while none of
+ * the file comes. The timeout runs from the last packet of the file, so
+ * that packets of other transfers do not put repair off. Each NACK goes
+ * to the next sender in turn, so that one that has gone away does not
+ * hold up repair. Returns -1 once the senders stop answering.
+ */
+static int wait_repair(struct recv_file *rf, int s, struct repair_timer *rt)
+{
+	double since, left;
+
+	while (1) {
+		since = rt->nack_sent ? rt->nack_sent : rt->last_arrival;
+		left = since + repair_timeout(rt) - now();
+		if (left > 0 && wait_packet(s, left))
+			return 0;
+
+		if (rt->nack_tries == REPAIR_NACK_TRIES) {
+			/* No response from the senders. */
+			fprintf(stderr, "Timed out with %u of %u blocks\n",
+				rf->map.num_done, rf->num_blocks);
+			return -1;
+		}
+		if (rf->num_sources)
+			send_nacks(rf, s, &rf->sources[rt->nack_tries %
+							rf->num_sources]);
+		rt->nack_sent = now();
+		rt->nack_tries++;
 	}
-	num_recv_in_block = malloc(num_blocks * sizeof(*num_recv_in_block));
-	num_recv_in_block[block_id]++;
-	if (num_recv_in_block[block_id] == DATA_FILES_PER_BLOCK)
-		blocks_filled++;
-
-	/* Create file that holds the received file's meta data. */
-	size = asprintf(&meta_file_path, "%s/%s/b%0*d/b%0*d_meta.txt",
-			DECODED_DIR, filename,
-			num_digits(num_blocks - 1), block_id,
-			num_digits(num_blocks - 1), block_id);
-	if (size == -1) {
-		fprintf(stderr, "asprintf: cannot allocate meta file path\n");
-		return;
+}
+
+/* Senders of several files, or of several transfers of one, may share
+ * the address of the receiver.
+ */
+static int same_file(const struct recv_file *rf,
+		     const struct fountain_hdr *fountain_hdr)
+{
+	return ntohl(fountain_hdr->session) == rf->session &&
+	       ntohl(fountain_hdr->num_blocks) == rf->num_blocks &&
+	       ntohs(fountain_hdr->padding) == rf->padding &&
+	       !strncmp(rf->filename, fountain_hdr->filename,
+			FILENAME_MAX_LEN);
+}
+
+/* Every sender is told which blocks are complete, and sent a report,
+ * every @fb_interval seconds, and once more when the file is complete.
+ * When packets stop coming before the file is complete, the missing
+ * chunks are NACKed until a repair arrives.
+ */
+static int recv_file(int s, unsigned int num_threads, double fb_interval,
+		     int out_fd)
+{
+	struct tmp_sockaddr_storage srv;
+	socklen_t srv_len;
+	struct fountain_hdr *fountain_hdr;
+	struct recv_file rf;
+	pthread_t *threads;
+	ssize_t pkt_len, num_read;
+	unsigned long runts = 0;
+	unsigned int i;
+	double start, end, next_fb;
+	struct repair_timer rt;
+	int rc = 0, kept;
+
+	fountain_hdr = malloc(sizeof(*fountain_hdr) + CHUNK_SIZE);
+	assert(fountain_hdr);
+
+	/* Wait as long as needed for the first packet. Control messages
+	 * and other runts that reach the socket are skipped.
+	 */
+	while (1) {
+		srv_len = sizeof(srv);
+		pkt_len = recvfrom(s, fountain_hdr,
+				   sizeof(*fountain_hdr) + CHUNK_SIZE,
+				   MSG_TRUNC, (struct sockaddr *)&srv,
+				   &srv_len);
+		assert(pkt_len >= 0);
+		if (pkt_len > (ssize_t)sizeof(*fountain_hdr))
+			break;
+		runts++;
 	}
-	meta_path_alloc_len = size + 1;
+	start = now();
+	next_fb = start + fb_interval;
 
-	rc = write_meta_data_to_file(meta_file_path, filename,
-				     num_blocks, block_id,
-				     (packet_len - sizeof(*fountain_hdr)) *
-				     DATA_FILES_PER_BLOCK);
-	if (rc < 0) {
-		fprintf(stderr, "fprintf: cannot write meta data to file\n");
-		return;
+	fprintf(stderr, "Receiving packets...\n");
+
+	if (open_recv_file(&rf, fountain_hdr, out_fd)) {
+		free(fountain_hdr);
+		return -1;
 	}
 
+	/* Create meta file with filename so that drink.rb knows
+	 * what file was received.
+	 */
+	create_name_file(rf.filename);
+	rf.foreign = runts;
+	if (rf.resumed)
+		resume_blocks(&rf);
+
+	threads = malloc(num_threads * sizeof(*threads));
+	assert(threads);
+	for (i = 0; i < num_threads; i++)
+		assert(!pthread_create(&threads[i], NULL, decode_thread, &rf));
+
 	/* Repeat the receive process until no more packets are received. */
-	while (blocks_filled < num_blocks) {
-		struct timeval timeout = {.tv_sec = 2, .tv_usec = 0};
-		fd_set readfds;
-
-		FD_ZERO(&readfds);
-		FD_SET(s, &readfds);
-		rc = select(s + 1, &readfds, NULL, NULL, &timeout);
-		assert(rc >= 0);
-		if (!rc)
-			/* No response from server. */
-			return;
-
-		/* Read how many bytes are in the packet. */
-		pkt_len = recvfrom(s, NULL, 0, MSG_PEEK|MSG_TRUNC, NULL, NULL);
-		assert(pkt_len > sizeof(*fountain_hdr));
-
-		/* Allocate a buffer for those bytes and read in the packet. */
-		fountain_hdr = alloca(pkt_len);
-		num_read = recvfrom(s, fountain_hdr, pkt_len, 0,
-				    (struct sockaddr *)&srv, &srv_len);
-		assert(pkt_len == num_read);
-
-		assert(ntohl(fountain_hdr->num_blocks) == num_blocks);
-		block_id = ntohl(fountain_hdr->block_id);
-		chunk_id = ntohs(fountain_hdr->chunk_id);
-		chunk_id_abs = chunk_id < 0 ? -chunk_id : chunk_id;
-		packet_len = ntohs(fountain_hdr->packet_len);
-		assert(padding == ntohs(fountain_hdr->padding));
-		assert(strncmp(filename, fountain_hdr->filename,
-		       strlen(filename)) == 0);
-
-		/* Use same buffer up to @alloc_len bytes. We
-		 * will never need more space than that.
-		 */
-
-		rc = create_file_path(recv_file_path, file_path_alloc_len,
-				 filename, num_blocks, block_id,
-				 chunk_id, chunk_id_abs);
-		if (rc < 0) {
-			fprintf(stderr, "snprintf: cannot create file path\n");
-			return;
-		}
-		num_written = write_data_to_file(recv_file_path,
-				fountain_hdr->data,
-				packet_len - sizeof(*fountain_hdr));
-		if (num_written != packet_len - sizeof(*fountain_hdr)) {
-			fprintf(stderr,
-				"fwrite: cannot write packet to file\n");
-			return;
-		}
-		num_recv_in_block[block_id]++;
-		if (num_recv_in_block[block_id] == DATA_FILES_PER_BLOCK)
-			blocks_filled++;
+	memset(&rt, 0, sizeof(rt));
+	rt.last_arrival = start;
+	num_read = pkt_len;
+	while (1) {
+		if (num_read <= (ssize_t)sizeof(*fountain_hdr)) {
+			rf.foreign++;
+		} else if (num_read >
+			   (ssize_t)(sizeof(*fountain_hdr) + CHUNK_SIZE)) {
+			fprintf(stderr, "Dropping oversized packet\n");
+		} else if (!same_file(&rf, fountain_hdr)) {
+			rf.foreign++;
+		} else {
+			struct source *src = find_source(&rf, s, &srv,
+							 srv_len);
+			double t = now();
 
-		rc = create_meta_file_path(meta_file_path, meta_path_alloc_len,
-					   filename, num_blocks, block_id);
-		if (rc < 0) {
-			fprintf(stderr, "snprintf: cannot create meta path\n");
-			return;
+			repair_timer_arrival(&rt, t);
+			kept = recv_chunk(&rf, fountain_hdr, num_read);
+			if (kept < 0) {
+				rc = -1;
+				break;
+			}
+			if (src) {
+				src->packets++;
+				src->chunks += kept;
+				src->last_arrival = t;
+				src->report.num_recv++;
+				src->report.echo_block =
+					ntohl(fountain_hdr->block_id);
+				src->report.echo_chunk =
+					ntohs(fountain_hdr->chunk_id);
+			}
 		}
-		rc = write_meta_data_to_file(meta_file_path, filename,
-			num_blocks, block_id,
-			(packet_len - sizeof(*fountain_hdr)) *
-			DATA_FILES_PER_BLOCK);
-		if (rc < 0) {
-			fprintf(stderr,
-				"fprintf: cannot write meta data to file\n");
-			return;
+		if (rf.map.num_done == rf.num_blocks) {
+			send_feedback(&rf, s);
+			break;
+		}
+		if (now() >= next_fb) {
+			send_feedback(&rf, s);
+			next_fb = now() + fb_interval;
 		}
+
+		if (wait_repair(&rf, s, &rt))
+			break;
+
+		srv_len = sizeof(srv);
+		num_read = recvfrom(s, fountain_hdr,
+				    sizeof(*fountain_hdr) + CHUNK_SIZE,
+				    MSG_TRUNC, (struct sockaddr *)&srv,
+				    &srv_len);
+		assert(num_read >= 0);
 	}
+	end = now();
 
-	free(num_recv_in_block);
+	decode_queue_close(&rf.q);
+	for (i = 0; i < num_threads; i++)
+		assert(!pthread_join(threads[i], NULL));
+	free(threads);
+	if (rf.failed || journal_sync(&rf.journal))
+		rc = -1;
+
+	fprintf(stderr, "%u of %u blocks complete, %u of them decoded, "
+		"%lu duplicate and %lu unneeded chunks dropped\n",
+		rf.map.num_done, rf.num_blocks, rf.blocks_decoded,
+		rf.map.dups, rf.map.unneeded);
+	if (rf.blocks_written)
+		fprintf(stderr, "Received in %.3f s, last block written "
+			"%.3f s later\n", end - start,
+			rf.last_written > end ? rf.last_written - end : 0);
+	if (out_fd >= 0) {
+		if (rf.out.next < rf.num_blocks)
+			fprintf(stderr, "Stream stopped at block %u of %u\n",
+				rf.out.next, rf.num_blocks);
+		fprintf(stderr, "Streamed %u blocks, at most %u waiting for "
+			"an earlier one\n", rf.out.next,
+			rf.out.max_held);
+	}
+	if (rf.num_sources > 1)
+		for (i = 0; i < rf.num_sources; i++)
+			fprintf(stderr, "Source %u: %lu packets, %lu chunks "
+				"kept\n", i + 1, rf.sources[i].packets,
+				rf.sources[i].chunks);
+	if (rf.foreign)
+		fprintf(stderr, "%lu runts and packets of other transfers "
+			"dropped\n",
+			rf.foreign);
+	fprintf(stderr, "Journal: %lu records in %lu batches\n",
+		rf.journal.records, rf.journal.syncs);
+	pool_print_stats(stderr, "Coding buffers", &rf.coding_pool);
+	arena_print_stats(stderr, "Decode scratch", &rf.scratch);
+
+	if (!rc && rf.blocks_written == rf.num_blocks)
+		rc = finish_file(&rf);
+	else if (!rc)
+		fprintf(stderr, "%u blocks incomplete, received data left "
+			"in %s; run drink again to resume\n",
+			rf.num_blocks - rf.blocks_written, rf.part_path);
+
+	close_recv_file(&rf);
+	free(fountain_hdr);
+	return rc;
+}
+
+/* Open @dest, "-" for stdout or host:port for a TCP connection. */
+static int open_output(const char *dest)
+{
+	struct addrinfo hints, *res, *ai;
+	char *host, *port;
+	int fd = -1, rc;
+
+	if (!strcmp(dest, "-"))
+		return STDOUT_FILENO;
+
+	host = strdup(dest);
+	assert(host);
+	port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "Invalid output: %s\n", dest);
+		goto host;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo(host, port, &hints, &res);
+	if (rc) {
+		fprintf(stderr, "getaddrinfo: %s: %s\n", dest,
+			gai_strerror(rc));
+		goto host;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		fprintf(stderr, "Cannot connect to %s\n", dest);
+	freeaddrinfo(res);
+host:
+	free(host);
+	return fd;
 }
 
 int main(int argc, char *argv[])
 {
 	struct sockaddr *cli;
-	int s, cli_len;
+	unsigned int num_threads = DEF_DECODE_THREADS;
+	unsigned int fb_ms = DEF_FEEDBACK_MS;
+	const char *dest = NULL;
+	int s, cli_len, opt, rc, out_fd = -1;
 
-	if (check_cli_params(argc, argv))
+	while ((opt = getopt(argc, argv, "t:f:o:")) != -1) {
+		switch (opt) {
+		case 't':
+			if (sscanf(optarg, "%u", &num_threads) != 1 ||
+			    !num_threads) {
+				fprintf(stderr, "Invalid number of decode "
+					"threads: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'f':
+			if (sscanf(optarg, "%u", &fb_ms) != 1 || !fb_ms) {
+				fprintf(stderr, "Invalid feedback interval: "
+					"%s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'o':
+			dest = optarg;
+			break;
+		default:
+			printf(USAGE);
+			exit(1);
+		}
+	}
+	if (argc - optind != 1) {
+		printf(USAGE);
 		exit(1);
+	}
+
+	if (dest) {
+		out_fd = open_output(dest);
+		if (out_fd < 0)
+			exit(1);
+		/* A consumer that goes away fails the write instead. */
+		signal(SIGPIPE, SIG_IGN);
+	}
 
 	s = socket(AF_XIA, SOCK_DGRAM, get_xdp_type());
 	assert(s >= 0);
-	cli = get_addr(argv[1], &cli_len);
+	cli = get_addr(argv[optind], &cli_len);
 	assert(cli);
 	assert(!bind(s, cli, cli_len));
 
-	recv_file(s);
+	rc = recv_file(s, num_threads, fb_ms / 1000.0, out_fd);
 
+	if (out_fd > STDOUT_FILENO)
+		close(out_fd);
 	free(cli);
 	assert(!close(s));
-	return 0;
+	return rc ? 1 : 0;
 }
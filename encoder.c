@@ -63,6 +63,7 @@ is the file name with "_k#" or "_m#" and then the extension.
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <gf_rand.h>
 #include <unistd.h>
@@ -71,6 +72,8 @@ is the file name with "_k#" or "_m#" and then the extension.
 #include <jerasure/cauchy.h>
 #include <jerasure/liberation.h>
 #include "timing.h"
+#include "fecfile.h"
+#include "arena.h"
 
 #define N 10
 
@@ -86,6 +89,7 @@ enum Coding_Technique method;
 
 /* Function prototypes */
 int is_prime(int w);
+int parse_store_options(char *opts, int *parity_only, int *packed, int *checksums);
 void ctrl_bs_handler(int dummy);
 
 int jfread(void *ptr, int size, int nmembers, FILE *stream)
@@ -100,7 +104,7 @@ int jfread(void *ptr, int size, int nmembers, FILE *stream)
 int main (int argc, char **argv) {
 	FILE *fp, *fp2;				// file pointers
 	char *block;				// padding file
-	int size, newsize;			// size of file and temp size 
+	long long size, newsize;		// size of file and temp size 
 	struct stat status;			// finding file size
 
 	
@@ -109,7 +113,7 @@ int main (int argc, char **argv) {
 	int buffersize;					// paramter
 	int i;						// loop control variables
 	int blocksize;					// size of k+m files
-	int total;
+	long long total;
 	int extra;
 	
 	/* Jerasure Arguments */
@@ -127,6 +131,13 @@ int main (int argc, char **argv) {
 	char *bname;
 	int md;
 	char *curdir;
+	int parity_only;			// only store the coding files
+	int packed;				// store in a single container
+	int checksums;				// checksum the packed chunks
+	int store;				// a read-in is a whole block
+	struct fec_writer fw;			// packed container
+	int bd;					// digits of a block number
+	struct arena arena;			// block and coding buffers
 	
 	/* Timing variables */
 	struct timing t1, t2, t3, t4;
@@ -148,14 +159,20 @@ int main (int argc, char **argv) {
 	schedule = NULL;
 	
 	/* Error check Arguments*/
-	if (argc != 10) {
-		fprintf(stderr,  "usage: inputfile dname bname k m coding_technique w packetsize buffersize\n");
+	parity_only = packed = checksums = 0;
+	if (argc != 10 && (argc != 11 || parse_store_options(argv[10], &parity_only, &packed, &checksums) != 0)) {
+		fprintf(stderr,  "usage: inputfile dname bname k m coding_technique w packetsize buffersize [parity,packed,csum]\n");
 		fprintf(stderr,  "\nChoose one of the following coding techniques: \nreed_sol_van, \nreed_sol_r6_op, \ncauchy_orig, \ncauchy_good, \nliberation, \nblaum_roth, \nliber8tion");
 		fprintf(stderr,  "\n\nPacketsize is ignored for the reed_sol's");
 		fprintf(stderr,  "\nBuffersize of 0 means the buffersize is chosen automatically.\n");
-		fprintf(stderr,  "\nIf you just want to test speed, use an inputfile of \"-number\" where number is the size of the fake file you want to test.\n\n");
+		fprintf(stderr,  "\nIf you just want to test speed, use an inputfile of \"-number\" where number is the size of the fake file you want to test.\n");
+		fprintf(stderr,  "\nWith any of the comma-separated store options, every read-in of buffersize bytes is a block:");
+		fprintf(stderr,  "\n  parity - only write the m coding files, to dname/bname<block>/, and leave the k data files to be read from inputfile,");
+		fprintf(stderr,  "\n  packed - write all blocks to the single container dname.fec instead of one file per chunk,");
+		fprintf(stderr,  "\n  csum   - add a CRC32C of every chunk to the packed container.\n\n");
 		exit(0);
 	}
+	store = parity_only || packed;
 	/* Conversion of parameters and error checking */	
 	if (sscanf(argv[4], "%d", &k) == 0 || k <= 0) {
 		fprintf(stderr,  "Invalid value for k\n");
@@ -178,7 +195,7 @@ int main (int argc, char **argv) {
 			exit(0);
 		}
 	}
-	if (argc != 10) {
+	if (argc < 10) {
 		buffersize = 0;
 	}
 	else {
@@ -354,7 +371,7 @@ int main (int argc, char **argv) {
 		stat(argv[1], &status);	
 		size = status.st_size;
         } else {
-        	if (sscanf(argv[1]+1, "%d", &size) != 1 || size <= 0) {
+        	if (sscanf(argv[1]+1, "%lld", &size) != 1 || size <= 0) {
                 	fprintf(stderr, "Files starting with '-' should be sizes for randomly created input\n");
 			exit(1);
 		}
@@ -389,21 +406,34 @@ int main (int argc, char **argv) {
 	blocksize = newsize/k;
 
 	/* Allow for buffersize and determine number of read-ins */
-	if (size > buffersize && buffersize != 0) {
+	if (store && buffersize == 0) {
+		fprintf(stderr, "Store options require a buffersize.\n");
+		exit(0);
+	}
+	/* The read-in and the coding buffers are allocated once, aligned,
+	   from one arena, on huge pages when there are any */
+	arena_init(&arena, 0, ARENA_F_HUGE);
+	if ((size > buffersize || store) && buffersize != 0) {
 		if (newsize%buffersize != 0) {
 			readins = newsize/buffersize;
 		}
 		else {
 			readins = newsize/buffersize;
 		}
-		block = (char *)malloc(sizeof(char)*buffersize);
+		block = (char *)arena_alloc(&arena, buffersize);
 		blocksize = buffersize/k;
 	}
 	else {
+		/* The whole file is one read-in */
+		if (newsize > INT_MAX) {
+			fprintf(stderr, "Files over 2 GB need a buffersize.\n");
+			exit(1);
+		}
 		readins = 1;
 		buffersize = size;
-		block = (char *)malloc(sizeof(char)*newsize);
+		block = (char *)arena_alloc(&arena, newsize);
 	}
+	if (block == NULL) { perror("mmap"); exit(1); }
 	
 	/* Break inputfile name into the filename and extension */	
 	s1 = (char*)malloc(sizeof(char)*(strlen(argv[1])+20));
@@ -424,16 +454,38 @@ int main (int argc, char **argv) {
         }
 	
 	/* Allocate for full file name */
-	fname = (char*)malloc(sizeof(char)*(strlen(argv[1])+strlen(curdir)+20));
+	fname = (char*)malloc(sizeof(char)*(strlen(argv[1])+strlen(argv[2])+strlen(argv[3])+strlen(curdir)+40));
 	sprintf(temp, "%d", k);
 	md = strlen(temp);
+	bd = snprintf(NULL, 0, "%d", readins - 1);
+
+	/* Create the packed container */
+	if (packed && fp != NULL) {
+		sprintf(fname, "%s/%s/%s.fec", curdir, ENCODED_DIR, dname);
+		if (fec_create(&fw, fname, k, m, blocksize, readins, size,
+			       status.st_mtime,
+			       (parity_only ? FEC_F_PARITY_ONLY : 0) |
+			       (checksums ? FEC_F_CHECKSUMS : 0)) != 0) {
+			fprintf(stderr, "Unable to create %s.\n", fname);
+			exit(0);
+		}
+	}
+
+	/* Create the directory of the parity-only store */
+	if (parity_only && !packed && fp != NULL) {
+		sprintf(fname, "%s/%s/%s", curdir, ENCODED_DIR, dname);
+		if (mkdir(fname, S_IRWXU) == -1 && errno != EEXIST) {
+			fprintf(stderr, "Unable to create %s.\n", fname);
+			exit(0);
+		}
+	}
 	
 	/* Allocate data and coding */
 	data = (char **)malloc(sizeof(char*)*k);
 	coding = (char **)malloc(sizeof(char*)*m);
 	for (i = 0; i < m; i++) {
-		coding[i] = (char *)malloc(sizeof(char)*blocksize);
-                if (coding[i] == NULL) { perror("malloc"); exit(1); }
+		coding[i] = (char *)arena_alloc(&arena, blocksize);
+		if (coding[i] == NULL) { perror("mmap"); exit(1); }
 	}
 
 	
@@ -493,12 +545,12 @@ int main (int argc, char **argv) {
 		else if (total < size && total+buffersize > size) {
 			extra = jfread(block, sizeof(char), buffersize, fp);
 			for (i = extra; i < buffersize; i++) {
-				block[i] = '0';
+				block[i] = store ? '\0' : '0';
 			}
 		}
 		else if (total == size) {
 			for (i = 0; i < buffersize; i++) {
-				block[i] = '0';
+				block[i] = store ? '\0' : '0';
 			}
 		}
 	
@@ -539,11 +591,26 @@ int main (int argc, char **argv) {
 		}
 		timing_set(&t4);
 	
-		/* Write data and encoded data to k+m files */
+		/* Append the block to the packed container */
+		if (packed && fp != NULL) {
+			for (i = parity_only ? k : 0; i < k+m; i++) {
+				if (fec_write_chunk(&fw, i < k ? data[i] : coding[i-k]) != 0) {
+					fprintf(stderr, "Unable to write %s.\n", fname);
+					exit(0);
+				}
+			}
+			n++;
+			totalsec += timing_delta(&t3, &t4);
+			continue;
+		}
+
+		/* Write data and encoded data to k+m files. A parity-only
+		   store skips the data, which spray reads from inputfile,
+		   and gives every read-in its own block directory. */
 		for	(i = 1; i <= k; i++) {
 			if (fp == NULL) {
 				bzero(data[i-1], blocksize);
- 			} else {
+ 			} else if (!parity_only) {
 				sprintf(fname, "%s/%s/%s/%s/k%0*d", curdir,
 					ENCODED_DIR, dname, bname, md, i);
 				if (n == 1) {
@@ -560,6 +627,18 @@ int main (int argc, char **argv) {
 		for	(i = 1; i <= m; i++) {
 			if (fp == NULL) {
 				bzero(data[i-1], blocksize);
+ 			} else if (parity_only) {
+				sprintf(fname, "%s/%s/%s/%s%0*d", curdir,
+					ENCODED_DIR, dname, bname, bd, n-1);
+				if (i == 1 && mkdir(fname, S_IRWXU) == -1 &&
+				    errno != EEXIST) {
+					fprintf(stderr, "Unable to create %s.\n", fname);
+					exit(0);
+				}
+				sprintf(fname + strlen(fname), "/m%0*d", md, i);
+				fp2 = fopen(fname, "wb");
+				fwrite(coding[i-1], sizeof(char), blocksize, fp2);
+				fclose(fp2);
  			} else {
 				sprintf(fname, "%s/%s/%s/%s/m%0*d", curdir,
 					ENCODED_DIR, dname, bname, md, i);
@@ -578,13 +657,39 @@ int main (int argc, char **argv) {
 		totalsec += timing_delta(&t3, &t4);
 	}
 
+	/* Create the index of the parity-only store: the number of
+	   blocks, as spray.rb writes it, and the layout and version of
+	   inputfile that the coding files belong to */
+	if (fp != NULL && packed) {
+		if (fec_finish(&fw) != 0) {
+			fprintf(stderr, "Unable to write %s.\n", fname);
+			exit(0);
+		}
+	}
+	else if (fp != NULL && parity_only) {
+		sprintf(fname, "%s/%s/%s/meta.txt", curdir, ENCODED_DIR, dname);
+		fp2 = fopen(fname, "wb");
+		fprintf(fp2, "%d\n", readins);
+		fclose(fp2);
+
+		sprintf(fname, "%s/%s/%s/index.txt", curdir, ENCODED_DIR,
+			dname);
+		fp2 = fopen(fname, "wb");
+		fprintf(fp2, "parity\n");
+		fprintf(fp2, "%lld\n", size);
+		fprintf(fp2, "%ld\n", (long)status.st_mtime);
+		fprintf(fp2, "%d %d %d\n", k, m, blocksize);
+		fprintf(fp2, "%s\n", bname);
+		fclose(fp2);
+	}
+
 	/* Create metadata file */
-        if (fp != NULL) {
+        if (fp != NULL && !store) {
 		sprintf(fname, "%s/%s/%s/%s/meta.txt", curdir, ENCODED_DIR,
 			dname, bname);
 		fp2 = fopen(fname, "wb");
 		fprintf(fp2, "%s\n", argv[1]);
-		fprintf(fp2, "%d\n", size);
+		fprintf(fp2, "%lld\n", size);
 		fprintf(fp2, "%d %d %d %d %d\n", k, m, w, packetsize, buffersize);
 		fprintf(fp2, "%s\n", argv[6]);
 		fprintf(fp2, "%d\n", tech);
@@ -596,8 +701,9 @@ int main (int argc, char **argv) {
 	/* Free allocated memory */
 	free(s1);
 	free(fname);
-	free(block);
 	free(curdir);
+	arena_print_stats(stderr, "Buffers", &arena.stats);
+	arena_destroy(&arena);
 	
 	/* Calculate rate in MB/sec and print */
 	timing_set(&t2);
@@ -608,6 +714,21 @@ int main (int argc, char **argv) {
 	return 0;
 }
 
+/* parse_store_options sets the flags named in the comma-separated
+   list opts; it returns 0 on success, -1 on an unknown option */
+int parse_store_options(char *opts, int *parity_only, int *packed, int *checksums) {
+	char *opt;
+
+	for (opt = strtok(opts, ","); opt != NULL; opt = strtok(NULL, ",")) {
+		if (strcmp(opt, "parity") == 0) *parity_only = 1;
+		else if (strcmp(opt, "packed") == 0) *packed = 1;
+		else if (strcmp(opt, "csum") == 0) *checksums = 1;
+		else return -1;
+	}
+	if (*checksums && !*packed) return -1;
+	return 0;
+}
+
 /* is_prime returns 1 if number if prime, 0 if not prime */
 int is_prime(int w) {
 	int prime55[] = {2,3,5,7,11,13,17,19,23,29,31,37,41,43,47,53,59,61,67,71,
@@ -0,0 +1,173 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fecfile.h"
+
+/* Filled once, by whichever thread needs it first. */
+static __u32 crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void)
+{
+	__u32 i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+		crc32c_table[i] = crc;
+	}
+}
+
+__u32 fec_crc32c(__u32 crc, const void *buf, size_t len)
+{
+	const __u8 *p = buf;
+
+	assert(!pthread_once(&crc32c_once, crc32c_init));
+
+	crc = ~crc;
+	while (len--)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static inline __u32 per_block(const struct fec_hdr *hdr)
+{
+	return hdr->flags & FEC_F_PARITY_ONLY ? hdr->m : hdr->k + hdr->m;
+}
+
+int fec_create(struct fec_writer *w, const char *path, int k, int m,
+	       int chunk_size, __u32 num_blocks, __u64 orig_size,
+	       __s64 src_mtime, __u32 flags)
+{
+	static const __u8 zeros[FEC_HDR_SIZE];
+	struct fec_hdr *hdr = &w->hdr;
+	__u64 num_chunks;
+
+	memset(w, 0, sizeof(*w));
+	memcpy(hdr->magic, FEC_MAGIC, sizeof(hdr->magic));
+	hdr->version = FEC_VERSION;
+	hdr->flags = flags;
+	hdr->k = k;
+	hdr->m = m;
+	hdr->chunk_size = chunk_size;
+	hdr->num_blocks = num_blocks;
+	hdr->orig_size = orig_size;
+	hdr->src_mtime = src_mtime;
+	hdr->chunk_off = FEC_HDR_SIZE;
+
+	num_chunks = (__u64)num_blocks * per_block(hdr);
+	if (flags & FEC_F_CHECKSUMS) {
+		hdr->csum_off = hdr->chunk_off + num_chunks * chunk_size;
+		w->csums = malloc(num_chunks * sizeof(*w->csums));
+		if (!w->csums)
+			return -1;
+	}
+
+	w->fp = fopen(path, "wb");
+	if (!w->fp)
+		goto csums;
+
+	/* The header is complete up front, so the file is written in
+	 * one sequential pass.
+	 */
+	if (fwrite(hdr, sizeof(*hdr), 1, w->fp) != 1 ||
+	    fwrite(zeros, FEC_HDR_SIZE - sizeof(*hdr), 1, w->fp) != 1)
+		goto fp;
+	return 0;
+
+fp:
+	fclose(w->fp);
+csums:
+	free(w->csums);
+	return -1;
+}
+
+int fec_write_chunk(struct fec_writer *w, const void *chunk)
+{
+	if (w->csums)
+		w->csums[w->num_written] = fec_crc32c(0, chunk,
+						      w->hdr.chunk_size);
+	w->num_written++;
+	return fwrite(chunk, w->hdr.chunk_size, 1, w->fp) == 1 ? 0 : -1;
+}
+
+int fec_finish(struct fec_writer *w)
+{
+	int rc = 0;
+
+	assert(w->num_written == (__u64)w->hdr.num_blocks * per_block(&w->hdr));
+	if (w->csums && fwrite(w->csums, sizeof(*w->csums), w->num_written,
+			       w->fp) != w->num_written)
+		rc = -1;
+	if (fclose(w->fp))
+		rc = -1;
+	free(w->csums);
+	return rc;
+}
+
+int fec_open(struct fec_file *f, const char *path)
+{
+	const struct fec_hdr *hdr;
+	struct stat st;
+	__u64 end;
+	int fd;
+
+	memset(f, 0, sizeof(*f));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < FEC_HDR_SIZE) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	f->map_len = st.st_size;
+	f->map = mmap(NULL, f->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED)
+		return -1;
+
+	hdr = f->map;
+	f->hdr = hdr;
+	f->per_block = per_block(hdr);
+	end = hdr->chunk_off +
+	      (__u64)hdr->num_blocks * f->per_block * hdr->chunk_size;
+	if (hdr->csum_off)
+		end = hdr->csum_off +
+		      (__u64)hdr->num_blocks * f->per_block * sizeof(__u32);
+
+	if (memcmp(hdr->magic, FEC_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != FEC_VERSION || end > f->map_len ||
+	    !!hdr->csum_off != !!(hdr->flags & FEC_F_CHECKSUMS)) {
+		fec_close(f);
+		errno = EINVAL;
+		return -1;
+	}
+
+	f->chunks = (const __u8 *)f->map + hdr->chunk_off;
+	if (hdr->csum_off)
+		f->csums = (const __u32 *)((const __u8 *)f->map +
+					   hdr->csum_off);
+	return 0;
+}
+
+void fec_close(struct fec_file *f)
+{
+	assert(!munmap(f->map, f->map_len));
+}
+
+int fec_chunk_ok(const struct fec_file *f, __u32 block_id, int slot)
+{
+	if (!f->csums)
+		return 1;
+	return f->csums[(size_t)block_id * f->per_block + slot] ==
+	       fec_crc32c(0, fec_chunk(f, block_id, slot), f->hdr->chunk_size);
+}
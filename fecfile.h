@@ -0,0 +1,94 @@
+#ifndef _FECFILE_H
+#define _FECFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <linux/types.h>
+
+/* Packed container of an encoded file, in host byte order:
+ *
+ *	struct fec_hdr, padded to FEC_HDR_SIZE
+ *	num_blocks * per_block chunks of chunk_size bytes, block by block,
+ *		data chunks first unless FEC_F_PARITY_ONLY, then coding chunks
+ *	num_blocks * per_block CRC32C checksums if FEC_F_CHECKSUMS
+ *
+ * The chunk array has a fixed stride and starts on a page boundary, so
+ * a mapping of the file can be indexed and sent from directly.
+ */
+#define FEC_MAGIC		"FNTNFEC1"
+#define FEC_HDR_SIZE		4096
+#define FEC_VERSION		1
+
+/* Only the coding chunks are stored; data chunks are read from the
+ * source file, whose size and mtime are recorded in the header.
+ */
+#define FEC_F_PARITY_ONLY	0x1
+#define FEC_F_CHECKSUMS		0x2
+
+struct fec_hdr {
+	char	magic[8];
+	__u32	version;
+	__u32	flags;
+	__u32	k;
+	__u32	m;
+	__u32	chunk_size;
+	__u32	num_blocks;
+	__u64	orig_size;
+	__s64	src_mtime;
+	__u64	chunk_off;
+	__u64	csum_off;
+};
+
+struct fec_writer {
+	FILE		*fp;
+	struct fec_hdr	hdr;
+	__u32		*csums;
+	__u64		num_written;
+};
+
+struct fec_file {
+	void			*map;
+	size_t			map_len;
+	const struct fec_hdr	*hdr;
+	const __u8		*chunks;
+	const __u32		*csums;
+	__u32			per_block;
+};
+
+__u32 fec_crc32c(__u32 crc, const void *buf, size_t len);
+
+/* Writing is sequential: call fec_write_chunk() for every stored chunk
+ * in container order, then fec_finish().
+ */
+int fec_create(struct fec_writer *w, const char *path, int k, int m,
+	       int chunk_size, __u32 num_blocks, __u64 orig_size,
+	       __s64 src_mtime, __u32 flags);
+int fec_write_chunk(struct fec_writer *w, const void *chunk);
+int fec_finish(struct fec_writer *w);
+
+int fec_open(struct fec_file *f, const char *path);
+void fec_close(struct fec_file *f);
+
+/* Stored slot of chunk @idx (0..k-1 for data, k..k+m-1 for coding) of
+ * a block, or -1 if the container does not hold it.
+ */
+static inline int fec_slot(const struct fec_file *f, int idx)
+{
+	if (f->hdr->flags & FEC_F_PARITY_ONLY)
+		return idx < (int)f->hdr->k ? -1 : idx - (int)f->hdr->k;
+	return idx;
+}
+
+static inline const __u8 *fec_chunk(const struct fec_file *f,
+				    __u32 block_id, int slot)
+{
+	return f->chunks +
+		((size_t)block_id * f->per_block + slot) * f->hdr->chunk_size;
+}
+
+/* Returns 1 if the chunk in @slot of @block_id matches its checksum, or
+ * if the container has no checksums.
+ */
+int fec_chunk_ok(const struct fec_file *f, __u32 block_id, int slot);
+
+#endif /* _FECFILE_H */
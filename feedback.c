@@ -0,0 +1,282 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/select.h>
+#include "feedback.h"
+
+#define CHUNKS_PER_BLOCK	(DATA_FILES_PER_BLOCK + CODE_FILES_PER_BLOCK)
+
+int feedback_init(struct feedback *fb, const char *filename,
+		  __u32 num_blocks)
+{
+	memset(fb, 0, sizeof(*fb));
+	strncpy(fb->filename, filename, FILENAME_MAX_LEN);
+	fb->num_blocks = num_blocks;
+	fb->done = calloc((num_blocks + BITS_PER_LONG - 1) / BITS_PER_LONG,
+			  sizeof(*fb->done));
+	return fb->done ? 0 : -1;
+}
+
+void feedback_free(struct feedback *fb)
+{
+	free(fb->done);
+}
+
+static void apply_runs(struct feedback *fb, const struct fountain_run *runs,
+		       unsigned int num_runs)
+{
+	unsigned int i;
+	__u32 b;
+
+	for (i = 0; i < num_runs; i++) {
+		__u32 first = ntohl(runs[i].first);
+		__u32 count = ntohl(runs[i].count);
+
+		if (first >= fb->num_blocks || count > fb->num_blocks - first)
+			continue;
+		for (b = first; b < first + count; b++) {
+			unsigned long bit = 1UL << (b % BITS_PER_LONG);
+
+			if (fb->done[b / BITS_PER_LONG] & bit)
+				continue;
+			fb->done[b / BITS_PER_LONG] |= bit;
+			fb->num_done++;
+		}
+	}
+}
+
+static void apply_nacks(struct feedback *fb,
+			const struct fountain_nack *nacks,
+			unsigned int num_nacks)
+{
+	unsigned int i;
+
+	if (!fb->repair)
+		return;
+	for (i = 0; i < num_nacks; i++) {
+		__u32 block_id = ntohl(nacks[i].block_id);
+
+		if (block_id < fb->num_blocks && !feedback_done(fb, block_id))
+			fb->repair(fb->repair_arg, block_id,
+				   ntohl(nacks[i].recv_mask));
+	}
+}
+
+static void apply_report(struct feedback *fb,
+			 const struct fountain_report *wire)
+{
+	struct fountain_report rep;
+
+	rep.num_recv = ntohl(wire->num_recv);
+	rep.echo_block = ntohl(wire->echo_block);
+	rep.echo_chunk = ntohs(wire->echo_chunk);
+	rep.unused = 0;
+	rep.hold_us = ntohl(wire->hold_us);
+	fb->report(fb->report_arg, &rep);
+}
+
+void feedback_poll(struct feedback *fb, int s)
+{
+	union {
+		struct feedback_msg	done;
+		struct nack_msg		nack;
+		struct {
+			struct fountain_ctl	ctl;
+			struct fountain_report	rep;
+		} report;
+	} msg;
+	size_t len;
+	ssize_t n;
+
+	while ((n = recvfrom(s, &msg, sizeof(msg), MSG_DONTWAIT,
+			     NULL, NULL)) >= 0) {
+		int type = fountain_ctl_type(&msg, n);
+
+		if (type < 0 || strncmp(msg.done.ctl.filename, fb->filename,
+					FILENAME_MAX_LEN))
+			continue;
+		len = n - sizeof(msg.done.ctl);
+		switch (type) {
+		case FOUNTAIN_CTL_DONE:
+			apply_runs(fb, msg.done.runs,
+				   len / sizeof(msg.done.runs[0]));
+			break;
+		case FOUNTAIN_CTL_NACK:
+			apply_nacks(fb, msg.nack.nacks,
+				    len / sizeof(msg.nack.nacks[0]));
+			break;
+		case FOUNTAIN_CTL_REPORT:
+			if (fb->report && len == sizeof(msg.report.rep))
+				apply_report(fb, &msg.report.rep);
+			break;
+		}
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		fprintf(stderr, "%s: recvfrom errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+}
+
+void feedback_msg_init(struct feedback_msg *msg, const char *filename)
+{
+	memset(msg, 0, sizeof(*msg));
+	fountain_ctl_init(&msg->ctl, FOUNTAIN_CTL_DONE, filename,
+			  sizeof(msg->ctl));
+}
+
+void feedback_msg_add(struct feedback_msg *msg, __u32 block_id)
+{
+	struct fountain_run *run;
+
+	if (msg->num_runs) {
+		run = &msg->runs[msg->num_runs - 1];
+		if (ntohl(run->first) + ntohl(run->count) == block_id) {
+			run->count = htonl(ntohl(run->count) + 1);
+			return;
+		}
+	}
+	if (msg->num_runs == FEEDBACK_MAX_RUNS)
+		return;
+
+	run = &msg->runs[msg->num_runs++];
+	run->first = htonl(block_id);
+	run->count = htonl(1);
+}
+
+void feedback_msg_send(struct feedback_msg *msg, int s,
+		       const struct sockaddr *dst, socklen_t dst_len)
+{
+	__u16 len = sizeof(msg->ctl) + msg->num_runs * sizeof(msg->runs[0]);
+
+	/* struct fountain_ctl has no trailing padding, so @runs follows
+	 * it directly.
+	 */
+	assert(offsetof(struct feedback_msg, runs) == sizeof(msg->ctl));
+	msg->ctl.len = htons(len);
+	send_packet(s, (const char *)msg, len, dst, dst_len);
+}
+
+void feedback_linger(struct feedback *fb, int s, double linger)
+{
+	while (fb->num_done < fb->num_blocks) {
+		struct timeval timeout;
+		fd_set readfds;
+		int rc;
+
+		timeout.tv_sec = linger;
+		timeout.tv_usec = (linger - timeout.tv_sec) * 1000000;
+		FD_ZERO(&readfds);
+		FD_SET(s, &readfds);
+		rc = select(s + 1, &readfds, NULL, NULL, &timeout);
+		assert(rc >= 0);
+		if (!rc)
+			break;
+		feedback_poll(fb, s);
+	}
+}
+
+unsigned int feedback_repair_ids(__u32 recv_mask, __s16 *chunk_ids)
+{
+	int held = __builtin_popcount(recv_mask);
+	unsigned int n = 0;
+	int i;
+
+	for (i = 0; i < CHUNKS_PER_BLOCK && held < DATA_FILES_PER_BLOCK; i++) {
+		if (recv_mask & (1U << i))
+			continue;
+		chunk_ids[n++] = i < DATA_FILES_PER_BLOCK
+			? i + 1 : DATA_FILES_PER_BLOCK - i - 1;
+		held++;
+	}
+	return n;
+}
+
+void nack_msg_init(struct nack_msg *msg, const char *filename)
+{
+	memset(msg, 0, sizeof(*msg));
+	fountain_ctl_init(&msg->ctl, FOUNTAIN_CTL_NACK, filename,
+			  sizeof(msg->ctl));
+}
+
+int nack_msg_add(struct nack_msg *msg, __u32 block_id, __u32 recv_mask)
+{
+	struct fountain_nack *nack;
+
+	if (msg->num_nacks == FEEDBACK_MAX_NACKS)
+		return -1;
+	nack = &msg->nacks[msg->num_nacks++];
+	nack->block_id = htonl(block_id);
+	nack->recv_mask = htonl(recv_mask);
+	return 0;
+}
+
+void nack_msg_send(struct nack_msg *msg, int s, const struct sockaddr *dst,
+		   socklen_t dst_len)
+{
+	__u16 len = sizeof(msg->ctl) +
+		    msg->num_nacks * sizeof(msg->nacks[0]);
+
+	assert(offsetof(struct nack_msg, nacks) == sizeof(msg->ctl));
+	msg->ctl.len = htons(len);
+	send_packet(s, (const char *)msg, len, dst, dst_len);
+}
+
+void feedback_send_report(int s, const struct sockaddr *dst,
+			  socklen_t dst_len, const char *filename,
+			  const struct fountain_report *rep)
+{
+	struct {
+		struct fountain_ctl	ctl;
+		struct fountain_report	rep;
+	} msg;
+
+	assert(sizeof(msg) == sizeof(msg.ctl) + sizeof(msg.rep));
+	fountain_ctl_init(&msg.ctl, FOUNTAIN_CTL_REPORT, filename,
+			  sizeof(msg));
+	msg.rep.num_recv = htonl(rep->num_recv);
+	msg.rep.echo_block = htonl(rep->echo_block);
+	msg.rep.echo_chunk = htons(rep->echo_chunk);
+	msg.rep.unused = 0;
+	msg.rep.hold_us = htonl(rep->hold_us);
+	send_packet(s, (const char *)&msg, sizeof(msg), dst, dst_len);
+}
+
+double repair_timeout(const struct repair_timer *rt)
+{
+	double rto = rt->srtt ? rt->srtt + 4 * rt->rttvar : REPAIR_INIT_RTO;
+
+	if (rto < REPAIR_MIN_RTO)
+		rto = REPAIR_MIN_RTO;
+	if (rto < REPAIR_IDLE_GAPS * rt->gap)
+		rto = REPAIR_IDLE_GAPS * rt->gap;
+	/* Back off while NACKs go unanswered. */
+	rto *= 1 << rt->nack_tries;
+	return rto < REPAIR_MAX_RTO ? rto : REPAIR_MAX_RTO;
+}
+
+void repair_timer_arrival(struct repair_timer *rt, double t)
+{
+	if (rt->nack_sent) {
+		double rtt = t - rt->nack_sent;
+
+		/* Only an answer to a single NACK is unambiguous. */
+		if (rt->nack_tries == 1) {
+			if (!rt->srtt) {
+				rt->srtt = rtt;
+				rt->rttvar = rtt / 2;
+			} else {
+				double err = rtt > rt->srtt ? rtt - rt->srtt
+							    : rt->srtt - rtt;
+
+				rt->rttvar = 0.75 * rt->rttvar + 0.25 * err;
+				rt->srtt = 0.875 * rt->srtt + 0.125 * rtt;
+			}
+		}
+		rt->nack_sent = 0;
+		rt->nack_tries = 0;
+	} else {
+		rt->gap = 0.875 * rt->gap + 0.125 * (t - rt->last_arrival);
+	}
+	rt->last_arrival = t;
+}
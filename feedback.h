@@ -0,0 +1,129 @@
+#ifndef _FEEDBACK_H
+#define _FEEDBACK_H
+
+#include <limits.h>
+#include "fountain.h"
+
+#define FEEDBACK_MAX_RUNS	128
+#define FEEDBACK_MAX_NACKS	128
+
+/* Senders look for feedback once every this many packets. */
+#define FEEDBACK_POLL_PKTS	64
+
+#define BITS_PER_LONG		(sizeof(long) * CHAR_BIT)
+
+/* Called for every block that a receiver asked to repair. */
+typedef void (*feedback_repair_fn)(void *arg, __u32 block_id,
+				   __u32 recv_mask);
+
+/* Called for every receiver report, in host byte order. */
+typedef void (*feedback_report_fn)(void *arg,
+				   const struct fountain_report *rep);
+
+/* Sender side view of the blocks that a receiver reported complete. */
+struct feedback {
+	char			filename[FILENAME_MAX_LEN];
+	__u32			num_blocks;
+	unsigned long		*done;
+	__u32			num_done;
+	unsigned long		skipped;	/* Packets not sent. */
+	feedback_repair_fn	repair;
+	void			*repair_arg;
+	feedback_report_fn	report;
+	void			*report_arg;
+};
+
+int feedback_init(struct feedback *fb, const char *filename,
+		  __u32 num_blocks);
+void feedback_free(struct feedback *fb);
+
+/* Apply every FOUNTAIN_CTL_DONE message for @fb waiting on @s without
+ * blocking, and pass the blocks of FOUNTAIN_CTL_NACK messages to
+ * @fb->repair and FOUNTAIN_CTL_REPORT messages to @fb->report if they
+ * are set. Any other message is consumed and dropped.
+ */
+void feedback_poll(struct feedback *fb, int s);
+
+/* Keep answering feedback on @s until the receiver reports every block
+ * complete, or until nothing arrives for @linger seconds.
+ */
+void feedback_linger(struct feedback *fb, int s, double linger);
+
+/* Fill @chunk_ids with the IDs of just enough chunks that the receiver
+ * of a NACK does not hold to complete the block, missing data chunks
+ * first since they spare the receiver a decode. Returns their number.
+ */
+unsigned int feedback_repair_ids(__u32 recv_mask, __s16 *chunk_ids);
+
+static inline int feedback_done(const struct feedback *fb, __u32 block_id)
+{
+	return !!(fb->done[block_id / BITS_PER_LONG] &
+		  (1UL << (block_id % BITS_PER_LONG)));
+}
+
+/* Receiver side: a FOUNTAIN_CTL_DONE message built from the completed
+ * blocks in increasing order. Runs past FEEDBACK_MAX_RUNS are left out
+ * and reported by a later message once the gaps between them close.
+ */
+struct feedback_msg {
+	struct fountain_ctl	ctl;
+	struct fountain_run	runs[FEEDBACK_MAX_RUNS];
+	unsigned int		num_runs;
+};
+
+void feedback_msg_init(struct feedback_msg *msg, const char *filename);
+void feedback_msg_add(struct feedback_msg *msg, __u32 block_id);
+void feedback_msg_send(struct feedback_msg *msg, int s,
+		       const struct sockaddr *dst, socklen_t dst_len);
+
+/* Receiver side: a FOUNTAIN_CTL_NACK message. */
+struct nack_msg {
+	struct fountain_ctl	ctl;
+	struct fountain_nack	nacks[FEEDBACK_MAX_NACKS];
+	unsigned int		num_nacks;
+};
+
+void nack_msg_init(struct nack_msg *msg, const char *filename);
+
+/* Returns -1 if @msg is full. */
+int nack_msg_add(struct nack_msg *msg, __u32 block_id, __u32 recv_mask);
+void nack_msg_send(struct nack_msg *msg, int s, const struct sockaddr *dst,
+		   socklen_t dst_len);
+
+/* Receiver side: send @rep, in host byte order, in a
+ * FOUNTAIN_CTL_REPORT message.
+ */
+void feedback_send_report(int s, const struct sockaddr *dst,
+			  socklen_t dst_len, const char *filename,
+			  const struct fountain_report *rep);
+
+/* Receiver side: bounds of the idle timeout after which missing chunks
+ * are NACKed, in seconds, and the number of unanswered NACKs before
+ * giving up.
+ */
+#define REPAIR_INIT_RTO		1.0
+#define REPAIR_MIN_RTO		0.05
+#define REPAIR_MAX_RTO		2.0
+#define REPAIR_IDLE_GAPS	16
+#define REPAIR_NACK_TRIES	6
+
+/* Round-trip time from a NACK to the first packet that answers it,
+ * estimated as in RFC 6298, and the smoothed gap between packets, so
+ * that a slow sender is not taken for one that has finished.
+ */
+struct repair_timer {
+	double	srtt;		/* 0 until the first sample. */
+	double	rttvar;
+	double	gap;
+	double	last_arrival;
+	double	nack_sent;	/* 0 if no NACK awaits an answer. */
+	int	nack_tries;
+};
+
+/* Seconds without a packet after which to NACK, or NACK again. */
+double repair_timeout(const struct repair_timer *rt);
+
+/* A packet of the file arrived at time @t. */
+void repair_timer_arrival(struct repair_timer *rt, double t);
+
+#endif /* _FEEDBACK_H */
@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "fstore.h"
+
+#define USAGE	"usage:\t./fountain-read [-c cache-MB] [-s source] "\
+		"store offset:length...\n"
+
+#define DEF_CACHE_MB	16
+#define BUF_SIZE	(1 << 20)
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, buf, len);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "%s: write errno=%i: %s\n",
+				__func__, errno, strerror(errno));
+			return -1;
+		}
+		buf += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Write range @arg of @store to stdout. */
+static int read_range(struct fountain_store *store, const char *arg,
+		      char *buf)
+{
+	unsigned long long offset, len;
+	ssize_t n;
+	int end;
+
+	if (sscanf(arg, "%llu:%llu%n", &offset, &len, &end) != 2 || arg[end]) {
+		fprintf(stderr, "Invalid range: %s\n", arg);
+		return -1;
+	}
+
+	while (len) {
+		n = fountain_read_range(store, offset,
+					len < BUF_SIZE ? len : BUF_SIZE, buf);
+		if (n < 0) {
+			fprintf(stderr, "Cannot read %s at %llu\n", arg,
+				offset);
+			return -1;
+		}
+		if (!n)
+			break;
+		if (write_all(STDOUT_FILENO, buf, n))
+			return -1;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct fountain_store_stats st;
+	struct fountain_store *store;
+	const char *src_path = NULL;
+	int cache_mb = DEF_CACHE_MB, opt, i, rc = 0;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "c:s:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cache_mb = atoi(optarg);
+			break;
+		case 's':
+			src_path = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (argc - optind < 2 || cache_mb < 0) {
+		fprintf(stderr, USAGE);
+		return 1;
+	}
+
+	store = fountain_store_open(argv[optind], src_path,
+				    (size_t)cache_mb << 20);
+	if (!store)
+		return 1;
+	buf = malloc(BUF_SIZE);
+	assert(buf);
+
+	for (i = optind + 1; i < argc && !rc; i++)
+		rc = read_range(store, argv[i], buf);
+
+	fountain_store_get_stats(store, &st);
+	fprintf(stderr, "%llu bytes; blocks: %lu copied, %lu cached, "
+		"%lu decoded, %lu failed\n",
+		(unsigned long long)fountain_store_size(store), st.copied,
+		st.cached, st.decoded, st.failed);
+	free(buf);
+	fountain_store_close(store);
+	return !!rc;
+}
@@ -0,0 +1,498 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include "fountain.h"
+#include "codec.h"
+#include "feedback.h"
+#include "recvmap.h"
+
+#define DECODED_DIR		"decoded"
+
+#define REQ_TRIES		10
+
+#define USAGE	"usage:\t./fountain-recv [-f feedback-ms] "\
+		"[-r srv_addr_file filename] cli_addr_file\n"
+
+/* Received chunks of a single block in codec order (data chunks first,
+ * then coding chunks), only allocated while the block is being filled.
+ * Which of them are held is in the recvmap of the file.
+ */
+struct block {
+	__u8	*chunks;
+};
+
+struct recv_file {
+	char		filename[FILENAME_MAX_LEN + 1];
+	char		*file_path;
+	int		fd;
+	__u32		num_blocks;
+	__u16		padding;
+	__u32		session;
+	struct block	*blocks;
+	struct recvmap	map;
+	__u32		blocks_decoded;
+	struct codec	codec;
+	struct fountain_report report;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int open_recv_file(struct recv_file *rf,
+			  const struct fountain_hdr *fountain_hdr)
+{
+	int rc;
+
+	memset(rf, 0, sizeof(*rf));
+	snprintf(rf->filename, sizeof(rf->filename), "%.*s",
+		 FILENAME_MAX_LEN, fountain_hdr->filename);
+	rf->num_blocks = ntohl(fountain_hdr->num_blocks);
+	rf->padding = ntohs(fountain_hdr->padding);
+	rf->session = ntohl(fountain_hdr->session);
+
+	if (!rf->num_blocks || rf->padding >= BLOCK_SIZE) {
+		fprintf(stderr, "Invalid header for %s\n", rf->filename);
+		return -1;
+	}
+
+	rc = mkdir(DECODED_DIR, 0777);
+	if (rc < 0 && errno != EEXIST) {
+		fprintf(stderr, "%s: mkdir errno=%i on %s: %s\n",
+			__func__, errno, DECODED_DIR, strerror(errno));
+		return -1;
+	}
+
+	rc = asprintf(&rf->file_path, "%s/%s", DECODED_DIR, rf->filename);
+	if (rc == -1) {
+		fprintf(stderr, "asprintf: cannot allocate file path\n");
+		return -1;
+	}
+
+	rf->fd = open(rf->file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (rf->fd < 0) {
+		fprintf(stderr, "%s: open errno=%i on %s: %s\n",
+			__func__, errno, rf->file_path, strerror(errno));
+		goto path;
+	}
+
+	rf->blocks = calloc(rf->num_blocks, sizeof(*rf->blocks));
+	if (!rf->blocks) {
+		fprintf(stderr, "calloc: cannot allocate %u blocks\n",
+			rf->num_blocks);
+		goto fd;
+	}
+
+	if (recvmap_init(&rf->map, rf->num_blocks)) {
+		fprintf(stderr, "calloc: cannot allocate %u blocks\n",
+			rf->num_blocks);
+		goto blocks;
+	}
+
+	if (codec_init(&rf->codec, DATA_FILES_PER_BLOCK,
+		       CODE_FILES_PER_BLOCK)) {
+		fprintf(stderr, "codec_init: cannot create coding matrix\n");
+		goto map;
+	}
+	return 0;
+
+map:
+	recvmap_free(&rf->map);
+blocks:
+	free(rf->blocks);
+fd:
+	close(rf->fd);
+path:
+	free(rf->file_path);
+	return -1;
+}
+
+static void close_recv_file(struct recv_file *rf)
+{
+	__u32 i;
+
+	codec_free(&rf->codec);
+	recvmap_free(&rf->map);
+	for (i = 0; i < rf->num_blocks; i++)
+		free(rf->blocks[i].chunks);
+	free(rf->blocks);
+	assert(!close(rf->fd));
+	free(rf->file_path);
+}
+
+/* Rebuild any missing data chunks of @block_id and write the
+ * block to its final place in the output file.
+ */
+static int complete_block(struct recv_file *rf, __u32 block_id)
+{
+	struct block *block = &rf->blocks[block_id];
+	__u32 recv_mask = recvmap_mask(&rf->map, block_id);
+	char *data[DATA_FILES_PER_BLOCK];
+	char *coding[CODE_FILES_PER_BLOCK];
+	int erasures[CHUNKS_PER_BLOCK + 1];
+	int i, num_erased = 0, data_erased = 0;
+	ssize_t rc;
+
+	for (i = 0; i < CHUNKS_PER_BLOCK; i++) {
+		char *chunk = (char *)block->chunks + i * CHUNK_SIZE;
+
+		if (i < DATA_FILES_PER_BLOCK)
+			data[i] = chunk;
+		else
+			coding[i - DATA_FILES_PER_BLOCK] = chunk;
+
+		if (!(recv_mask & (1U << i))) {
+			erasures[num_erased++] = i;
+			if (i < DATA_FILES_PER_BLOCK)
+				data_erased = 1;
+		}
+	}
+	erasures[num_erased] = -1;
+
+	if (data_erased) {
+		if (codec_decode(&rf->codec, erasures, data, coding,
+				 CHUNK_SIZE) < 0) {
+			fprintf(stderr, "Cannot decode block %u\n", block_id);
+			return -1;
+		}
+		rf->blocks_decoded++;
+	}
+
+	/* The data chunks are contiguous in @block->chunks. */
+	rc = pwrite(rf->fd, block->chunks, BLOCK_SIZE,
+		    (off_t)block_id * BLOCK_SIZE);
+	if (rc != BLOCK_SIZE) {
+		fprintf(stderr, "%s: pwrite errno=%i on %s: %s\n",
+			__func__, errno, rf->file_path, strerror(errno));
+		return -1;
+	}
+
+	free(block->chunks);
+	block->chunks = NULL;
+	return 0;
+}
+
+static int recv_chunk(struct recv_file *rf,
+		      const struct fountain_hdr *fountain_hdr,
+		      unsigned int num_read)
+{
+	struct block *block;
+	__u32 block_id = ntohl(fountain_hdr->block_id);
+	__u16 packet_len = ntohs(fountain_hdr->packet_len);
+	int idx = recvmap_index(ntohs(fountain_hdr->chunk_id));
+	enum recvmap_result res;
+
+	if (ntohl(fountain_hdr->session) != rf->session ||
+	    ntohl(fountain_hdr->num_blocks) != rf->num_blocks ||
+	    ntohs(fountain_hdr->padding) != rf->padding ||
+	    strncmp(rf->filename, fountain_hdr->filename, FILENAME_MAX_LEN))
+		/* Packet of another file or transfer. */
+		return 0;
+
+	rf->report.num_recv++;
+	rf->report.echo_block = block_id;
+	rf->report.echo_chunk = ntohs(fountain_hdr->chunk_id);
+
+	if (block_id >= rf->num_blocks || idx < 0 ||
+	    packet_len != num_read ||
+	    packet_len - sizeof(*fountain_hdr) != CHUNK_SIZE) {
+		fprintf(stderr, "Dropping malformed packet\n");
+		return 0;
+	}
+
+	res = recvmap_add(&rf->map, block_id, idx);
+	if (res == RECVMAP_DUP)
+		/* Duplicate, or the block no longer needs chunks. */
+		return 0;
+
+	block = &rf->blocks[block_id];
+
+	if (!block->chunks) {
+		block->chunks = malloc(CHUNKS_PER_BLOCK * CHUNK_SIZE);
+		if (!block->chunks) {
+			fprintf(stderr, "malloc: cannot allocate block %u\n",
+				block_id);
+			return -1;
+		}
+	}
+
+	memcpy(block->chunks + idx * CHUNK_SIZE, fountain_hdr->data,
+	       CHUNK_SIZE);
+
+	if (res == RECVMAP_COMPLETE)
+		return complete_block(rf, block_id);
+	return 0;
+}
+
+/* Ask the sprayd at @srv for @filename until the first packet
+ * arrives. Returns -1 if the daemon never answers.
+ */
+static int request_file(int s, const struct sockaddr *srv, int srv_len,
+			const char *filename)
+{
+	struct fountain_ctl req;
+	int i, rc;
+
+	fountain_ctl_init(&req, FOUNTAIN_CTL_REQ, filename, sizeof(req));
+	for (i = 0; i < REQ_TRIES; i++) {
+		struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+		fd_set readfds;
+
+		send_packet(s, (const char *)&req, sizeof(req), srv, srv_len);
+
+		FD_ZERO(&readfds);
+		FD_SET(s, &readfds);
+		rc = select(s + 1, &readfds, NULL, NULL, &timeout);
+		assert(rc >= 0);
+		if (rc)
+			return 0;
+	}
+	fprintf(stderr, "No answer to the request for %s\n", filename);
+	return -1;
+}
+
+/* Tell the sender which blocks are complete so that it stops sending
+ * their chunks, and how many packets got through for its rate control.
+ */
+static void send_feedback(int s, struct recv_file *rf,
+			  const struct repair_timer *rt,
+			  const struct sockaddr *srv, socklen_t srv_len)
+{
+	struct feedback_msg msg;
+	__u32 i;
+
+	feedback_msg_init(&msg, rf->filename);
+	for (i = 0; i < rf->num_blocks; i++)
+		if (recvmap_done(&rf->map, i))
+			feedback_msg_add(&msg, i);
+	feedback_msg_send(&msg, s, srv, srv_len);
+
+	rf->report.hold_us = (now() - rt->last_arrival) * 1000000;
+	feedback_send_report(s, srv, srv_len, rf->filename, &rf->report);
+}
+
+/* Ask the sender for the chunks that incomplete blocks are missing,
+ * lowest blocks first.
+ */
+static void send_nacks(int s, const struct recv_file *rf,
+		       const struct sockaddr *srv, socklen_t srv_len)
+{
+	struct nack_msg msg;
+	__u32 i;
+
+	nack_msg_init(&msg, rf->filename);
+	for (i = 0; i < rf->num_blocks; i++)
+		if (!recvmap_done(&rf->map, i) &&
+		    nack_msg_add(&msg, i, recvmap_mask(&rf->map, i)))
+			break;
+	fprintf(stderr, "Asking for repair of %u blocks\n",
+		rf->num_blocks - rf->map.num_done);
+	nack_msg_send(&msg, s, srv, srv_len);
+}
+
+static int wait_packet(int s, double secs)
+{
+	struct timeval timeout;
+	fd_set readfds;
+	int rc;
+
+	timeout.tv_sec = secs;
+	timeout.tv_usec = (secs - timeout.tv_sec) * 1000000;
+	FD_ZERO(&readfds);
+	FD_SET(s, &readfds);
+	rc = select(s + 1, &readfds, NULL, NULL, &timeout);
+	assert(rc >= 0);
+	return rc;
+}
+
+/* Returns the length of the next datagram on @s, which is more than
+ * @len if it was cut short, or -1 on error.
+ */
+static ssize_t recv_packet(int s, void *buf, size_t len,
+			   struct sockaddr *src, socklen_t *src_len)
+{
+	ssize_t rc;
+
+	do {
+		rc = recvfrom(s, buf, len, MSG_TRUNC, src, src_len);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0)
+		fprintf(stderr, "%s: recvfrom errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+	return rc;
+}
+
+/* When packets stop coming before the file is complete, the missing
+ * chunks are NACKed to the source of the first packet until a repair
+ * arrives. With a nonzero @fb_interval, completed blocks are reported
+ * at most every @fb_interval seconds. The sender is always told once
+ * the file is complete.
+ */
+static int recv_file(int s, double fb_interval)
+{
+	struct recv_file rf;
+	struct fountain_hdr *fountain_hdr;
+	struct tmp_sockaddr_storage src;
+	socklen_t src_len = sizeof(src);
+	ssize_t pkt_len, num_read;
+	double start, elapsed, next_fb;
+	struct repair_timer rt;
+	off_t file_size;
+	int rc = -1;
+
+	fountain_hdr = malloc(sizeof(*fountain_hdr) + CHUNK_SIZE);
+	assert(fountain_hdr);
+
+	/* Wait as long as needed for the first packet. */
+	pkt_len = recv_packet(s, fountain_hdr,
+			      sizeof(*fountain_hdr) + CHUNK_SIZE,
+			      (struct sockaddr *)&src, &src_len);
+	start = now();
+	next_fb = start + fb_interval;
+	if (pkt_len < 0)
+		goto out;
+	if (pkt_len < (ssize_t)sizeof(*fountain_hdr)) {
+		fprintf(stderr, "Dropping runt first packet\n");
+		goto out;
+	}
+	if (open_recv_file(&rf, fountain_hdr))
+		goto out;
+
+	fprintf(stderr, "Receiving %s...\n", rf.filename);
+
+	memset(&rt, 0, sizeof(rt));
+	rt.last_arrival = start;
+	num_read = pkt_len;
+	while (1) {
+		if (num_read < (ssize_t)sizeof(*fountain_hdr))
+			fprintf(stderr, "Dropping runt packet\n");
+		else if (num_read >
+			 (ssize_t)(sizeof(*fountain_hdr) + CHUNK_SIZE))
+			fprintf(stderr, "Dropping oversized packet\n");
+		else if (recv_chunk(&rf, fountain_hdr, num_read))
+			goto close;
+
+		if (rf.map.num_done == rf.num_blocks) {
+			send_feedback(s, &rf, &rt, (struct sockaddr *)&src,
+				      src_len);
+			break;
+		}
+		if (fb_interval && now() >= next_fb) {
+			send_feedback(s, &rf, &rt, (struct sockaddr *)&src,
+				      src_len);
+			next_fb = now() + fb_interval;
+		}
+
+		while (!wait_packet(s, repair_timeout(&rt))) {
+			if (rt.nack_tries == REPAIR_NACK_TRIES) {
+				/* No response from server. */
+				fprintf(stderr, "Timed out with %u of %u "
+					"blocks\n", rf.map.num_done,
+					rf.num_blocks);
+				rc = -1;
+				goto close;
+			}
+			send_nacks(s, &rf, (struct sockaddr *)&src, src_len);
+			rt.nack_sent = now();
+			rt.nack_tries++;
+		}
+
+		num_read = recv_packet(s, fountain_hdr,
+				       sizeof(*fountain_hdr) + CHUNK_SIZE,
+				       NULL, NULL);
+		if (num_read < 0) {
+			rc = -1;
+			goto close;
+		}
+		repair_timer_arrival(&rt, now());
+	}
+
+	/* Strip the padding that the sender added to the last block. */
+	file_size = (off_t)rf.num_blocks * BLOCK_SIZE - rf.padding;
+	rc = ftruncate(rf.fd, file_size);
+	if (rc < 0) {
+		fprintf(stderr, "%s: ftruncate errno=%i on %s: %s\n",
+			__func__, errno, rf.file_path, strerror(errno));
+		goto close;
+	}
+
+	elapsed = now() - start;
+	fprintf(stderr, "Received %s: %lld bytes in %.3f s (%.2f MB/s), "
+		"%u of %u blocks decoded, %lu duplicate and %lu unneeded "
+		"chunks\n", rf.file_path, (long long)file_size, elapsed,
+		file_size / 1024.0 / 1024.0 / elapsed,
+		rf.blocks_decoded, rf.num_blocks, rf.map.dups,
+		rf.map.unneeded);
+
+close:
+	close_recv_file(&rf);
+out:
+	free(fountain_hdr);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr *cli, *srv = NULL;
+	int s, cli_len, srv_len, rc, opt;
+	const char *req_filename = NULL;
+	unsigned int fb_ms = 0;
+
+	while ((opt = getopt(argc, argv, "f:r:")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (sscanf(optarg, "%u", &fb_ms) != 1 || !fb_ms) {
+				fprintf(stderr, "Invalid feedback interval: "
+					"%s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'r':
+			srv = get_addr(optarg, &srv_len);
+			assert(srv);
+			break;
+		default:
+			printf(USAGE);
+			exit(1);
+		}
+	}
+	if (argc - optind != (srv ? 2 : 1)) {
+		printf(USAGE);
+		exit(1);
+	}
+	if (srv) {
+		req_filename = argv[optind++];
+		if (strlen(req_filename) > FILENAME_MAX_LEN) {
+			fprintf(stderr, "File names are limited to %d "
+				"characters\n", FILENAME_MAX_LEN);
+			exit(1);
+		}
+	}
+
+	s = socket(AF_XIA, SOCK_DGRAM, get_xdp_type());
+	assert(s >= 0);
+	cli = get_addr(argv[optind], &cli_len);
+	assert(cli);
+	assert(!bind(s, cli, cli_len));
+
+	if (srv && request_file(s, srv, srv_len, req_filename))
+		rc = -1;
+	else
+		rc = recv_file(s, fb_ms / 1000.0);
+
+	free(srv);
+	free(cli);
+	assert(!close(s));
+	return rc ? 1 : 0;
+}
@@ -0,0 +1,655 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include "fountain.h"
+#include "codec.h"
+#include "pktq.h"
+#include "blkcache.h"
+#include "feedback.h"
+#include "ratectl.h"
+#include "impair.h"
+
+#define USAGE	"usage:\t./fountain-send [-F] [-L linger-s] "\
+		"[-R fixed|aimd|delay] [-p pps] [-A target]\n"\
+		"\t\t[-t encoder-threads] [-w window-blocks] "\
+		"[-q queue-windows] [-c cache-MB]\n"\
+		"\t\t[-I impairments] srv-bind-addr srv-dst-addr file-path "\
+		"failure-rate\n"\
+		"\t./fountain-send -S [options] srv-bind-addr srv-dst-addr "\
+		"failure-rate\n"\
+		"\t\t(serve the files whose paths are read from stdin)\n"
+
+#define CHUNKS_PER_BLOCK	(DATA_FILES_PER_BLOCK + CODE_FILES_PER_BLOCK)
+#define PACKET_SIZE		(sizeof(struct fountain_hdr) + CHUNK_SIZE)
+
+#define DEF_WINDOW_BLOCKS	16
+#define DEF_QUEUE_WINDOWS	8
+#define DEF_CACHE_MB		64
+#define DEF_LINGER		5
+
+/* A source file mapped read-only, with its last block padded with
+ * zeros in memory instead of on disk.
+ */
+struct send_file {
+	const char	*filename;
+	__u8		*map;
+	size_t		size;
+	__u32		num_blocks;
+	__u16		padding;
+	__u8		*tail;
+	struct codec	codec;
+	struct blkcache_key key;
+};
+
+/* Encoder threads turn windows of @window_blocks blocks into ready
+ * packets, interleaved the way spray.c interleaves a whole file, and
+ * queue them in @windows. The network thread sends the windows in
+ * order, so memory is bounded by the queue depth, not the file size.
+ */
+struct pipeline {
+	struct send_file	*sf;
+	struct fountain_hdr	hdr;
+	unsigned int		window_blocks;
+	unsigned int		queue_windows;
+	struct blkcache		*cache;
+	__u8			*windows;
+	struct pktq		q;
+	int			use_feedback;
+	unsigned int		linger;
+	const char		*ratectl;
+	double			pps;
+	double			target;
+	/* Simulated network, shared by all files served. */
+	struct impair		imp;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int open_send_file(struct send_file *sf, const char *file_path)
+{
+	struct stat st;
+	size_t tail_len;
+	int fd;
+
+	memset(sf, 0, sizeof(*sf));
+	sf->filename = basename(file_path);
+	/* The header has no room for more, and a cut name is another file. */
+	if (strlen(sf->filename) > FILENAME_MAX_LEN) {
+		fprintf(stderr, "%s: file names are limited to %d characters\n",
+			sf->filename, FILENAME_MAX_LEN);
+		return -1;
+	}
+
+	fd = open(file_path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: open errno=%i on %s: %s\n",
+			__func__, errno, file_path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size) {
+		fprintf(stderr, "%s is not a non-empty regular file\n",
+			file_path);
+		goto fd;
+	}
+	sf->size = st.st_size;
+	sf->key.dev = st.st_dev;
+	sf->key.ino = st.st_ino;
+	sf->key.size = st.st_size;
+	sf->key.mtime = st.st_mtim.tv_sec;
+	sf->key.mtime_nsec = st.st_mtim.tv_nsec;
+	sf->num_blocks = (sf->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	sf->padding = sf->num_blocks * BLOCK_SIZE - sf->size;
+
+	sf->map = mmap(NULL, sf->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (sf->map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap errno=%i on %s: %s\n",
+			__func__, errno, file_path, strerror(errno));
+		goto fd;
+	}
+	madvise(sf->map, sf->size, MADV_SEQUENTIAL);
+	close(fd);
+
+	/* Copy the last block so that it can be padded. */
+	tail_len = BLOCK_SIZE - sf->padding;
+	sf->tail = calloc(1, BLOCK_SIZE);
+	assert(sf->tail);
+	memcpy(sf->tail, sf->map + (size_t)(sf->num_blocks - 1) * BLOCK_SIZE,
+	       tail_len);
+
+	assert(!codec_init(&sf->codec, DATA_FILES_PER_BLOCK,
+			   CODE_FILES_PER_BLOCK));
+	return 0;
+
+fd:
+	close(fd);
+	return -1;
+}
+
+static void close_send_file(struct send_file *sf)
+{
+	codec_free(&sf->codec);
+	free(sf->tail);
+	assert(!munmap(sf->map, sf->size));
+}
+
+static inline __u8 *block_data(const struct send_file *sf, __u32 block_id)
+{
+	if (block_id == sf->num_blocks - 1)
+		return sf->tail;
+	return sf->map + (size_t)block_id * BLOCK_SIZE;
+}
+
+static inline unsigned int window_len(const struct pipeline *pl, long seq)
+{
+	__u32 first = seq * pl->window_blocks;
+	__u32 left = pl->sf->num_blocks - first;
+	return left < pl->window_blocks ? left : pl->window_blocks;
+}
+
+static inline __u8 *window_packet(const struct pipeline *pl, long seq,
+				  unsigned int i)
+{
+	size_t window_size = (size_t)pl->window_blocks * CHUNKS_PER_BLOCK *
+			     PACKET_SIZE;
+	return pl->windows + (seq % pl->queue_windows) * window_size +
+	       (size_t)i * PACKET_SIZE;
+}
+
+/* Lay out window @seq as chunk 1 of every block in the window, then
+ * chunk 2, and so on, with the coding chunks after the data chunks.
+ * The coding chunks are copied from the block cache or, on a miss,
+ * encoded directly into their packets.
+ */
+static void fill_window(struct pipeline *pl, long seq)
+{
+	struct send_file *sf = pl->sf;
+	unsigned int nb = window_len(pl, seq);
+	__u32 first = seq * pl->window_blocks;
+	unsigned int b;
+	int i;
+
+	for (b = 0; b < nb; b++) {
+		char *data[DATA_FILES_PER_BLOCK];
+		char *coding[CODE_FILES_PER_BLOCK];
+		__u8 *src = block_data(sf, first + b);
+
+		for (i = 0; i < CHUNKS_PER_BLOCK; i++) {
+			__u8 *pkt = window_packet(pl, seq, i * nb + b);
+			struct fountain_hdr *hdr = (struct fountain_hdr *)pkt;
+			__s16 chunk_id = i < DATA_FILES_PER_BLOCK
+				? i + 1 : DATA_FILES_PER_BLOCK - i - 1;
+
+			memcpy(hdr, &pl->hdr, sizeof(*hdr));
+			hdr->block_id = htonl(first + b);
+			hdr->chunk_id = htons(chunk_id);
+			hdr->packet_len = htons(PACKET_SIZE);
+
+			if (i < DATA_FILES_PER_BLOCK) {
+				memcpy(hdr->data, src + i * CHUNK_SIZE,
+				       CHUNK_SIZE);
+				data[i] = (char *)hdr->data;
+			} else {
+				coding[i - DATA_FILES_PER_BLOCK] =
+					(char *)hdr->data;
+			}
+		}
+
+		if (pl->cache) {
+			struct blkcache_key key = sf->key;
+
+			key.block_id = first + b;
+			if (blkcache_get(pl->cache, &key, coding))
+				continue;
+			codec_encode(&sf->codec, data, coding, CHUNK_SIZE);
+			blkcache_put(pl->cache, &key, coding);
+		} else {
+			codec_encode(&sf->codec, data, coding, CHUNK_SIZE);
+		}
+	}
+}
+
+static void *encoder_thread(void *arg)
+{
+	struct pipeline *pl = arg;
+	long seq;
+
+	while ((seq = pktq_reserve(&pl->q)) >= 0) {
+		fill_window(pl, seq);
+		pktq_commit(&pl->q, seq);
+	}
+	return NULL;
+}
+
+struct send_stats {
+	unsigned int	data_sent;
+	unsigned int	data_dropped;
+	unsigned int	code_sent;
+	unsigned int	code_dropped;
+	unsigned int	repair_sent;
+	unsigned int	repair_dropped;
+	unsigned int	code_skipped;
+	double		first_sent;
+};
+
+static void report(void *arg, const struct fountain_report *rep)
+{
+	ratectl_report(arg, rep);
+}
+
+struct repair_ctx {
+	int			s;
+	const struct sockaddr	*cli;
+	int			cli_len;
+	struct pipeline		*pl;
+	struct impair		*imp;
+	struct send_stats	*st;
+	struct ratectl		*rc;
+	__u8			coding[CODE_FILES_PER_BLOCK * CHUNK_SIZE];
+};
+
+/* Answer a NACK of @block_id with the chunks the receiver lacks. The
+ * code has a fixed rate, so the repair chunks are taken from the same
+ * k + m; the block is encoded again only if coding chunks are needed.
+ */
+static void repair_block(void *arg, __u32 block_id, __u32 recv_mask)
+{
+	struct repair_ctx *ctx = arg;
+	struct send_file *sf = ctx->pl->sf;
+	struct fountain_hdr hdr = ctx->pl->hdr;
+	__u8 *src = block_data(sf, block_id);
+	__s16 chunk_ids[DATA_FILES_PER_BLOCK];
+	unsigned int i, n = feedback_repair_ids(recv_mask, chunk_ids);
+	int encoded = 0;
+
+	for (i = 0; i < n; i++) {
+		__s16 chunk_id = chunk_ids[i];
+		const __u8 *chunk;
+
+		if (chunk_id > 0) {
+			chunk = src + (chunk_id - 1) * CHUNK_SIZE;
+		} else {
+			if (!encoded) {
+				char *data[DATA_FILES_PER_BLOCK];
+				char *coding[CODE_FILES_PER_BLOCK];
+				int j;
+
+				for (j = 0; j < DATA_FILES_PER_BLOCK; j++)
+					data[j] = (char *)src + j * CHUNK_SIZE;
+				for (j = 0; j < CODE_FILES_PER_BLOCK; j++)
+					coding[j] = (char *)ctx->coding +
+						    j * CHUNK_SIZE;
+				codec_encode(&sf->codec, data, coding,
+					     CHUNK_SIZE);
+				encoded = 1;
+			}
+			chunk = ctx->coding + (-chunk_id - 1) * CHUNK_SIZE;
+		}
+
+		ctx->st->repair_sent++;
+		ratectl_pace(ctx->rc);
+		ratectl_sent(ctx->rc, block_id, chunk_id);
+		if (impair_lose(ctx->imp)) {
+			ctx->st->repair_dropped++;
+			continue;
+		}
+		send_chunk(ctx->s, ctx->cli, ctx->cli_len, &hdr, block_id,
+			   chunk_id, chunk, CHUNK_SIZE);
+	}
+	impair_flush(ctx->imp, ctx->s);
+}
+
+/* With @fb, packets of the blocks that the receiver reported complete
+ * are skipped.
+ */
+static void send_windows(int s, const struct sockaddr *cli, int cli_len,
+			 struct pipeline *pl, struct impair *imp,
+			 struct ratectl *rc, struct feedback *fb,
+			 struct send_stats *st)
+{
+	unsigned long num_pkts = 0;
+	long seq;
+
+	while ((seq = pktq_peek(&pl->q)) >= 0) {
+		unsigned int i, n = window_len(pl, seq) * CHUNKS_PER_BLOCK;
+
+		for (i = 0; i < n; i++) {
+			const __u8 *pkt = window_packet(pl, seq, i);
+			const struct fountain_hdr *hdr =
+				(const struct fountain_hdr *)pkt;
+			int is_data = (__s16)ntohs(hdr->chunk_id) > 0;
+
+			if (fb) {
+				if (num_pkts++ % FEEDBACK_POLL_PKTS == 0)
+					feedback_poll(fb, s);
+				if (feedback_done(fb, ntohl(hdr->block_id))) {
+					fb->skipped++;
+					continue;
+				}
+			}
+			if (!is_data &&
+			    -(__s16)ntohs(hdr->chunk_id) > rc->code_chunks) {
+				st->code_skipped++;
+				continue;
+			}
+
+			if (is_data)
+				st->data_sent++;
+			else
+				st->code_sent++;
+
+			ratectl_pace(rc);
+			ratectl_sent(rc, ntohl(hdr->block_id),
+				     ntohs(hdr->chunk_id));
+			if (impair_lose(imp)) {
+				if (is_data)
+					st->data_dropped++;
+				else
+					st->code_dropped++;
+				continue;
+			}
+			send_packet(s, (const char *)pkt, PACKET_SIZE,
+				    cli, cli_len);
+			if (!st->first_sent)
+				st->first_sent = now();
+		}
+		pktq_release(&pl->q);
+	}
+}
+
+/* Returns -1 if the file cannot be sent. */
+static int fountain_send(int s, const struct sockaddr *cli, int cli_len,
+			 const char *file_path, unsigned int num_threads,
+			 struct pipeline *pl, double start)
+{
+	struct send_file sf;
+	struct send_stats st;
+	struct feedback fb;
+	struct repair_ctx repair;
+	struct ratectl rc;
+	int use_feedback = pl->use_feedback || pl->linger || pl->target ||
+			   strcmp(pl->ratectl, "fixed");
+	pthread_t *threads;
+	long num_windows;
+	unsigned int i;
+
+	if (open_send_file(&sf, file_path))
+		return -1;
+	pl->sf = &sf;
+	fountain_hdr_init(&pl->hdr, sf.filename, sf.num_blocks, sf.padding);
+
+	num_windows = (sf.num_blocks + pl->window_blocks - 1) /
+		      pl->window_blocks;
+	assert(!pktq_init(&pl->q, pl->queue_windows, num_windows));
+	pl->windows = malloc((size_t)pl->queue_windows * pl->window_blocks *
+			     CHUNKS_PER_BLOCK * PACKET_SIZE);
+	assert(pl->windows);
+
+	threads = malloc(num_threads * sizeof(*threads));
+	assert(threads);
+	for (i = 0; i < num_threads; i++)
+		assert(!pthread_create(&threads[i], NULL, encoder_thread, pl));
+
+	memset(&st, 0, sizeof(st));
+	assert(!ratectl_init(&rc, pl->ratectl, pl->pps));
+	ratectl_set_target(&rc, pl->target);
+	if (use_feedback) {
+		assert(!feedback_init(&fb, sf.filename, sf.num_blocks));
+		repair.s = s;
+		repair.cli = cli;
+		repair.cli_len = cli_len;
+		repair.pl = pl;
+		repair.imp = &pl->imp;
+		repair.st = &st;
+		repair.rc = &rc;
+		fb.repair = repair_block;
+		fb.repair_arg = &repair;
+		fb.report = report;
+		fb.report_arg = &rc;
+	}
+
+	send_windows(s, cli, cli_len, pl, &pl->imp, &rc,
+		     use_feedback ? &fb : NULL, &st);
+	impair_flush(&pl->imp, s);
+
+	for (i = 0; i < num_threads; i++)
+		assert(!pthread_join(threads[i], NULL));
+	free(threads);
+	free(pl->windows);
+	pktq_destroy(&pl->q);
+
+	if (pl->linger)
+		feedback_linger(&fb, s, pl->linger);
+
+	fprintf(stderr, "Dropped %d data packets out of %d (%.1f%%)\n",
+		st.data_dropped, st.data_sent, st.data_sent
+		? 100 * (float)st.data_dropped / st.data_sent : 0);
+	fprintf(stderr, "Dropped %d code packets out of %d (%.1f%%)\n",
+		st.code_dropped, st.code_sent, st.code_sent
+		? 100 * (float)st.code_dropped / st.code_sent : 0);
+	if (st.first_sent)
+		fprintf(stderr, "First packet sent after %.3f ms\n",
+			(st.first_sent - start) * 1000);
+	if (use_feedback) {
+		fprintf(stderr, "Skipped %lu packets (%lu bytes) of %u blocks "
+			"reported complete\n", fb.skipped,
+			fb.skipped * PACKET_SIZE, fb.num_done);
+		fprintf(stderr, "Dropped %d repair packets out of %d\n",
+			st.repair_dropped, st.repair_sent);
+		feedback_free(&fb);
+	}
+	if (pl->target)
+		fprintf(stderr, "Skipped %u coding packets (%lu bytes), "
+			"%d of %d per block at the end\n", st.code_skipped,
+			(unsigned long)st.code_skipped * PACKET_SIZE,
+			rc.code_chunks, CODE_FILES_PER_BLOCK);
+	fprintf(stderr, "Rate control %s: %.0f pps at the end, %lu reports, "
+		"%.1f%% loss, %.3f ms RTT\n", pl->ratectl, rc.rate,
+		rc.num_reports, 100 * rc.loss, 1000 * rc.srtt);
+	ratectl_free(&rc);
+	close_send_file(&sf);
+	return 0;
+}
+
+/* Serve the files whose paths are read from @in, one per line, to the
+ * same destination. Blocks are encoded lazily at send time, and the
+ * block cache keeps the hot ones in memory across files.
+ */
+static void serve(int s, const struct sockaddr *cli, int cli_len, FILE *in,
+		  unsigned int num_threads, struct pipeline *pl)
+{
+	char *line = NULL;
+	size_t line_len = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &line_len, in)) != -1) {
+		double start = now();
+
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (!len)
+			continue;
+
+		if (fountain_send(s, cli, cli_len, line, num_threads, pl,
+				  start))
+			continue;
+		fprintf(stderr, "%s sent.\n", line);
+
+		if (pl->cache) {
+			struct blkcache_stats st;
+
+			blkcache_get_stats(pl->cache, &st);
+			fprintf(stderr, "Block cache: %lu hits, %lu misses, "
+				"%lu evictions, %zu bytes\n", st.hits,
+				st.misses, st.evictions, st.bytes);
+		}
+	}
+	free(line);
+}
+
+static int parse_uint(const char *str, const char *what, unsigned int min,
+		      unsigned int *val)
+{
+	if (sscanf(str, "%u", val) != 1 || *val < min) {
+		fprintf(stderr, "Invalid %s: %s\n", what, str);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr *srv, *cli;
+	struct pipeline pl;
+	struct impair_cfg impair;
+	const char *impair_spec = NULL;
+	int s, srv_len, cli_len, opt, serving = 0, rc = 0;
+	unsigned int fr, num_threads, cache_mb = DEF_CACHE_MB;
+	long num_cpus;
+	double start = now();
+
+	memset(&pl, 0, sizeof(pl));
+	pl.window_blocks = DEF_WINDOW_BLOCKS;
+	pl.queue_windows = DEF_QUEUE_WINDOWS;
+	pl.ratectl = "fixed";
+	pl.pps = RATECTL_DEF_PPS;
+
+	/* Leave one CPU for the network thread. */
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	num_threads = num_cpus > 1 ? num_cpus - 1 : 1;
+
+	while ((opt = getopt(argc, argv, "t:w:q:c:SFL:R:p:A:I:")) != -1) {
+		switch (opt) {
+		case 't':
+			if (parse_uint(optarg, "thread count", 1,
+				       &num_threads))
+				return 1;
+			break;
+		case 'w':
+			if (parse_uint(optarg, "window", 1, &pl.window_blocks))
+				return 1;
+			break;
+		case 'q':
+			if (parse_uint(optarg, "queue depth", 1,
+				       &pl.queue_windows))
+				return 1;
+			break;
+		case 'c':
+			if (parse_uint(optarg, "cache size", 0, &cache_mb))
+				return 1;
+			break;
+		case 'S':
+			serving = 1;
+			break;
+		case 'F':
+			pl.use_feedback = 1;
+			break;
+		case 'L':
+			if (parse_uint(optarg, "linger time", 1, &pl.linger))
+				return 1;
+			break;
+		case 'R':
+			pl.ratectl = optarg;
+			if (!ratectl_find(optarg)) {
+				fprintf(stderr, "Unknown rate control: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			if (sscanf(optarg, "%lf", &pl.pps) != 1 || pl.pps < 1) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'I':
+			impair_spec = optarg;
+			break;
+		case 'A':
+			if (sscanf(optarg, "%lf", &pl.target) != 1 ||
+			    pl.target <= 0 || pl.target >= 1) {
+				fprintf(stderr, "Invalid target: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		default:
+			printf(USAGE);
+			return 1;
+		}
+	}
+	if (argc - optind != (serving ? 3 : 4)) {
+		printf(USAGE);
+		return 1;
+	}
+	argv += optind;
+
+	/* Blocks that fall short of k chunks are completed by repair. */
+	if (pl.target && !pl.linger)
+		pl.linger = DEF_LINGER;
+
+	if (sscanf(argv[serving ? 2 : 3], "%u", &fr) != 1 || fr > 100) {
+		fprintf(stderr, "Failure rate must be between 0 and 100.\n");
+		return 1;
+	}
+
+	/* The failure rate is the default loss of the simulated network. */
+	memset(&impair, 0, sizeof(impair));
+	impair.loss = fr / 100.0;
+	if ((impair_spec && impair_parse(&impair, impair_spec)) ||
+	    impair_init(&pl.imp, &impair))
+		return 1;
+	fountain_set_send_hook(impair_send, &pl.imp);
+
+	/* A single transfer never asks for a block twice. */
+	if (serving && cache_mb) {
+		pl.cache = blkcache_create((size_t)cache_mb << 20,
+					   CODE_FILES_PER_BLOCK, CHUNK_SIZE);
+		assert(pl.cache);
+	}
+
+	s = socket(AF_XIA, SOCK_DGRAM, get_xdp_type());
+	if (s < 0) {
+		int orig_errno = errno;
+		fprintf(stderr, "Cannot create XDP socket: %s\n",
+			strerror(orig_errno));
+		return 1;
+	}
+
+	srv = get_addr(argv[0], &srv_len);
+	assert(srv);
+	assert(!bind(s, srv, srv_len));
+	cli = get_addr(argv[1], &cli_len);
+	assert(cli);
+
+	if (serving) {
+		serve(s, cli, cli_len, stdin, num_threads, &pl);
+	} else if (!fountain_send(s, cli, cli_len, argv[2], num_threads, &pl,
+				  start)) {
+		fprintf(stderr, "File sent.\n");
+	} else {
+		rc = 1;
+	}
+
+	impair_print_stats(&pl.imp);
+	impair_free(&pl.imp);
+	if (pl.cache)
+		blkcache_destroy(pl.cache);
+	free(cli);
+	free(srv);
+	assert(!close(s));
+	return rc;
+}
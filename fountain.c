@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -14,6 +15,9 @@
 
 static int ppal_map_loaded = 0;
 
+static fountain_send_fn send_hook;
+static void *send_hook_arg;
+
 int file_exists(const char *filename)
 {
 	struct stat st;
@@ -46,6 +50,103 @@ int num_digits(int num)
 	return sprintf(snum, "%d", num);
 }
 
+void fountain_hdr_init(struct fountain_hdr *hdr, const char *filename,
+		       __u32 num_blocks, __u16 padding)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->num_blocks = htonl(num_blocks);
+	hdr->padding = htons(padding);
+	strncpy(hdr->filename, filename, FILENAME_MAX_LEN);
+}
+
+void fountain_set_send_hook(fountain_send_fn fn, void *arg)
+{
+	send_hook = fn;
+	send_hook_arg = arg;
+}
+
+void send_packet(int s, const char *buf, int n, const struct sockaddr *dst,
+	socklen_t dst_len)
+{
+	ssize_t rc = send_hook
+		? send_hook(send_hook_arg, s, buf, n, dst, dst_len)
+		: sendto(s, buf, n, 0, dst, dst_len);
+	if (rc < 0) {
+		fprintf(stderr, "%s: sendto errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+		exit(1);
+	}
+}
+
+ssize_t try_send_chunk(int s, const struct sockaddr *dst, socklen_t dst_len,
+		       struct fountain_hdr *hdr, __u32 block_id,
+		       __s16 chunk_id, const void *data, size_t len)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	assert(len <= CHUNK_SIZE);
+	hdr->block_id = htonl(block_id);
+	hdr->chunk_id = htons(chunk_id);
+	hdr->packet_len = htons(sizeof(*hdr) + len);
+
+	if (send_hook) {
+		__u8 buf[sizeof(*hdr) + CHUNK_SIZE];
+
+		memcpy(buf, hdr, sizeof(*hdr));
+		memcpy(buf + sizeof(*hdr), data, len);
+		return send_hook(send_hook_arg, s, buf, sizeof(*hdr) + len,
+				 dst, dst_len);
+	}
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(*hdr);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *)dst;
+	msg.msg_namelen = dst_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	return sendmsg(s, &msg, 0);
+}
+
+void send_chunk(int s, const struct sockaddr *dst, socklen_t dst_len,
+		struct fountain_hdr *hdr, __u32 block_id, __s16 chunk_id,
+		const void *data, size_t len)
+{
+	ssize_t rc = try_send_chunk(s, dst, dst_len, hdr, block_id, chunk_id,
+				    data, len);
+	if (rc < 0) {
+		fprintf(stderr, "%s: sendmsg errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+		exit(1);
+	}
+}
+
+void fountain_ctl_init(struct fountain_ctl *ctl, enum fountain_ctl_type type,
+		       const char *filename, __u16 len)
+{
+	assert(len >= sizeof(*ctl));
+	memset(ctl, 0, sizeof(*ctl));
+	ctl->magic = htonl(FOUNTAIN_CTL_MAGIC);
+	ctl->type = htons(type);
+	ctl->len = htons(len);
+	strncpy(ctl->filename, filename, FILENAME_MAX_LEN);
+}
+
+int fountain_ctl_type(const void *buf, size_t n)
+{
+	const struct fountain_ctl *ctl = buf;
+
+	if (n < sizeof(*ctl) || ntohl(ctl->magic) != FOUNTAIN_CTL_MAGIC ||
+	    ntohs(ctl->len) != n)
+		return -1;
+	return ntohs(ctl->type);
+}
+
 static inline void load_ppal_map(void)
 {
 	if (ppal_map_loaded)
@@ -12,18 +12,91 @@
 #define DATA_FILES_PER_BLOCK		10
 #define CODE_FILES_PER_BLOCK		10
 #define CHUNK_SIZE			384
-#define FILENAME_MAX_LEN		18
+/* The last 4 of the 18 bytes that name the file in a packet carry its
+ * session, so names are cut to 14 characters.
+ */
+#define FILENAME_MAX_LEN		14
+#define BLOCK_SIZE			(DATA_FILES_PER_BLOCK * CHUNK_SIZE)
 
+/* @session tells apart transfers of the same file, so that the
+ * senders of one, e.g. the shards of spray -P, can be told from those
+ * of another. It is 0 unless a sender was given one, which leaves the
+ * header as it was before sessions for names of up to 14 characters.
+ * The header stays 32 bytes, so that chunks that follow it in a buffer
+ * stay aligned.
+ */
 struct fountain_hdr {
 	__u32	num_blocks;
 	__u32	block_id;
 	__s16	chunk_id;
 	__u16	packet_len;
 	__u16	padding;
+	char	filename[FILENAME_MAX_LEN];
+	__u32	session;
+	__u8	data[0];
+};
+
+/* Control messages go from receivers back to senders. */
+#define FOUNTAIN_CTL_MAGIC		0x46544e43	/* "FTNC" */
+
+enum fountain_ctl_type {
+	/* Ask a sender daemon to spray @filename to the source address. */
+	FOUNTAIN_CTL_REQ = 1,
+	/* @data lists the blocks of @filename that the receiver has
+	 * completed as struct fountain_run entries.
+	 */
+	FOUNTAIN_CTL_DONE = 2,
+	/* @data lists incomplete blocks of @filename with the chunks the
+	 * receiver holds as struct fountain_nack entries.
+	 */
+	FOUNTAIN_CTL_NACK = 3,
+	/* @data holds a struct fountain_report for rate control. */
+	FOUNTAIN_CTL_REPORT = 4,
+};
+
+struct fountain_ctl {
+	__u32	magic;
+	__u16	type;
+	__u16	len;
 	char	filename[18];
 	__u8	data[0];
 };
 
+/* Blocks @first to @first + @count - 1, in network byte order. */
+struct fountain_run {
+	__u32	first;
+	__u32	count;
+};
+
+/* Bit i of @recv_mask is set if the receiver holds chunk i of the
+ * block, counting data chunks first, then coding chunks. In network
+ * byte order.
+ */
+struct fountain_nack {
+	__u32	block_id;
+	__u32	recv_mask;
+};
+
+/* How much of @filename a receiver got, and the last packet it got,
+ * which lets the sender measure loss and round-trip time without a
+ * timestamp in every packet. In network byte order.
+ */
+struct fountain_report {
+	__u32	num_recv;	/* Packets received, duplicates included. */
+	__u32	echo_block;
+	__s16	echo_chunk;
+	__u16	unused;
+	__u32	hold_us;	/* Since the echoed packet arrived. */
+};
+
+/* Fill in a control message header of @len bytes in total. */
+void fountain_ctl_init(struct fountain_ctl *ctl, enum fountain_ctl_type type,
+		       const char *filename, __u16 len);
+
+/* Returns the type of the control message in @buf, or -1 if the
+ * @n bytes in @buf are not a valid control message.
+ */
+int fountain_ctl_type(const void *buf, size_t n);
 
 int dir_exists(const char *filename);
 int file_exists(const char *filename);
@@ -43,6 +116,30 @@ struct sockaddr *get_addr(char *str1, int *plen);
 void send_packet(int s, const char *buf, int n, const struct sockaddr *dst,
 	socklen_t dst_len);
 
+/* Stands in for sendto() in send_packet() and try_send_chunk(). */
+typedef ssize_t (*fountain_send_fn)(void *arg, int s, const void *buf,
+				    size_t len, const struct sockaddr *dst,
+				    socklen_t dst_len);
+
+/* Route every packet sent through @fn, e.g. to impair the network, or
+ * back to sendto() if @fn is NULL.
+ */
+void fountain_set_send_hook(fountain_send_fn fn, void *arg);
+
+/* Fill in the fields of @hdr that are the same for every chunk of a file. */
+void fountain_hdr_init(struct fountain_hdr *hdr, const char *filename,
+		       __u32 num_blocks, __u16 padding);
+
+/* Send @len bytes of @data behind @hdr without copying them. */
+void send_chunk(int s, const struct sockaddr *dst, socklen_t dst_len,
+		struct fountain_hdr *hdr, __u32 block_id, __s16 chunk_id,
+		const void *data, size_t len);
+
+/* Like send_chunk(), but return -1 and leave errno set on failure. */
+ssize_t try_send_chunk(int s, const struct sockaddr *dst, socklen_t dst_len,
+		       struct fountain_hdr *hdr, __u32 block_id,
+		       __s16 chunk_id, const void *data, size_t len);
+
 xid_type_t get_xdp_type(void);
 
 int address_match(const struct sockaddr *addr, socklen_t addr_len,
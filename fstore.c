@@ -0,0 +1,457 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "blkcache.h"
+#include "blkdir.h"
+#include "codec.h"
+#include "fecfile.h"
+#include "fstore.h"
+#include "journal.h"
+
+/* The partial output of drink, and its journal. */
+#define PART_EXT	".part"
+#define JOURNAL_EXT	".journal"
+
+struct fountain_store {
+	int				k;
+	int				m;
+	int				chunk_size;
+	__u32				num_blocks;
+	__u64				size;
+
+	/* A packed container, with the source file if it is parity-only. */
+	int				packed;
+	struct fec_file			fec;
+	int				src_fd;
+
+	/* Or block directories. */
+	int				blocks;
+	struct blkdir			bd;
+
+	/* Or the partial output of drink, with what its journal lists. */
+	int				part;
+	int				part_fd;
+	struct journal_hdr		jhdr;
+	/* The chunks held of each block, and the coding chunks of the
+	 * blocks not yet decoded.
+	 */
+	__u32				*held;
+	char				**coding;
+
+	struct codec			codec;
+	struct blkcache			*cache;		/* Of data chunks. */
+	struct blkcache_key		key;
+	char				*scratch;	/* k + m chunks. */
+	struct fountain_store_stats	stats;
+};
+
+static int open_dir(struct fountain_store *store, const char *path)
+{
+	store->blocks = 1;
+	if (blkdir_open(&store->bd, path))
+		return -1;
+	store->k = store->bd.k;
+	store->m = store->bd.m;
+	store->chunk_size = store->bd.chunk_size;
+	store->num_blocks = store->bd.num_blocks;
+	store->size = (__u64)store->num_blocks * store->k * store->chunk_size -
+		      store->bd.padding;
+	return 0;
+}
+
+static void replay_record(void *arg, const struct journal_rec *rec,
+			  const void *payload)
+{
+	struct fountain_store *store = arg;
+	__u32 block_id = rec->block_id;
+	int idx = rec->idx;
+	char **coding;
+
+	if (block_id >= store->num_blocks || idx >= store->k + store->m)
+		return;
+	coding = &store->coding[block_id];
+
+	switch (rec->type) {
+	case JOURNAL_CHUNK:
+		if (idx < store->k) {
+			store->held[block_id] |= 1U << idx;
+			break;
+		}
+		if (rec->len != store->chunk_size)
+			break;
+		if (!*coding) {
+			*coding = malloc((size_t)store->m * store->chunk_size);
+			assert(*coding);
+		}
+		memcpy(*coding + (size_t)(idx - store->k) * store->chunk_size,
+		       payload, store->chunk_size);
+		store->held[block_id] |= 1U << idx;
+		break;
+	case JOURNAL_DECODED:
+		/* The block is whole in the output file. */
+		store->held[block_id] = (1U << store->k) - 1;
+		free(*coding);
+		*coding = NULL;
+		break;
+	}
+}
+
+/* Open the partial output of drink at @path, which holds the data
+ * chunks that its journal lists, while the journal holds the coding
+ * chunks. Only what the journal lists is read, so the output can be
+ * read while drink still writes to it.
+ */
+static int open_part(struct fountain_store *store, const char *path)
+{
+	struct journal_hdr hdr;
+	char journal_path[PATH_MAX];
+	struct stat st;
+	size_t len = strlen(path) - strlen(PART_EXT);
+
+	store->part = 1;
+	store->part_fd = open(path, O_RDONLY);
+	if (store->part_fd < 0) {
+		fprintf(stderr, "%s: open errno=%i on %s: %s\n",
+			__func__, errno, path, strerror(errno));
+		return -1;
+	}
+	if (snprintf(journal_path, sizeof(journal_path), "%.*s%s", (int)len,
+		     path, JOURNAL_EXT) >= (int)sizeof(journal_path) ||
+	    journal_read(journal_path, &store->jhdr, NULL, NULL)) {
+		fprintf(stderr, "%s: cannot read the journal of %s: %s\n",
+			__func__, path, strerror(errno));
+		return -1;
+	}
+	store->k = store->jhdr.k;
+	store->m = store->jhdr.m;
+	store->chunk_size = store->jhdr.chunk_size;
+	store->num_blocks = store->jhdr.num_blocks;
+	store->size = (__u64)store->num_blocks * store->k * store->chunk_size -
+		      store->jhdr.padding;
+	if (store->k <= 0 || store->k + store->m > 32) {
+		fprintf(stderr, "%s: cannot read %i + %i chunks per block\n",
+			journal_path, store->k, store->m);
+		return -1;
+	}
+	if (fstat(store->part_fd, &st) < 0 ||
+	    (__u64)st.st_size < store->size) {
+		fprintf(stderr, "%s is shorter than its journal says\n", path);
+		return -1;
+	}
+
+	store->held = calloc(store->num_blocks, sizeof(*store->held));
+	store->coding = calloc(store->num_blocks, sizeof(*store->coding));
+	assert(store->held && store->coding);
+	/* The journal may have been started over since its header was read. */
+	if (journal_read(journal_path, &hdr, replay_record, store) ||
+	    memcmp(&hdr, &store->jhdr, sizeof(hdr))) {
+		fprintf(stderr, "%s: cannot replay %s\n", __func__,
+			journal_path);
+		return -1;
+	}
+	return 0;
+}
+
+static int open_packed(struct fountain_store *store, const char *path,
+		       const char *src_path)
+{
+	const struct fec_hdr *hdr;
+	struct stat st;
+
+	if (fec_open(&store->fec, path) < 0) {
+		fprintf(stderr, "%s: cannot open %s: %s\n",
+			__func__, path, strerror(errno));
+		return -1;
+	}
+	store->packed = 1;
+	hdr = store->fec.hdr;
+	store->k = hdr->k;
+	store->m = hdr->m;
+	store->chunk_size = hdr->chunk_size;
+	store->num_blocks = hdr->num_blocks;
+	store->size = hdr->orig_size;
+
+	if (!(hdr->flags & FEC_F_PARITY_ONLY))
+		return 0;
+	if (!src_path) {
+		fprintf(stderr, "%s is parity-only and needs its source file\n",
+			path);
+		return -1;
+	}
+	store->src_fd = open(src_path, O_RDONLY);
+	if (store->src_fd < 0 || fstat(store->src_fd, &st) < 0 ||
+	    (__u64)st.st_size != hdr->orig_size ||
+	    st.st_mtime != hdr->src_mtime) {
+		fprintf(stderr, "Source of %s is missing or changed\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+struct fountain_store *fountain_store_open(const char *path,
+					   const char *src_path,
+					   size_t cache_budget)
+{
+	struct fountain_store *store;
+	size_t len = strlen(path);
+	struct stat st;
+	int rc;
+
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, "%s: stat errno=%i on %s: %s\n",
+			__func__, errno, path, strerror(errno));
+		return NULL;
+	}
+
+	store = calloc(1, sizeof(*store));
+	assert(store);
+	store->src_fd = -1;
+	store->part_fd = -1;
+	if (S_ISDIR(st.st_mode))
+		rc = open_dir(store, path);
+	else if (len > strlen(PART_EXT) &&
+		 !strcmp(path + len - strlen(PART_EXT), PART_EXT))
+		rc = open_part(store, path);
+	else
+		rc = open_packed(store, path, src_path);
+	if (rc)
+		goto store;
+
+	if (store->chunk_size <= 0 ||
+	    store->chunk_size % (CODEC_WORD_SIZE * CODEC_PACKET_SIZE *
+				 sizeof(long))) {
+		fprintf(stderr, "%s: chunk size %i cannot be decoded\n",
+			path, store->chunk_size);
+		goto store;
+	}
+	if (codec_init(&store->codec, store->k, store->m)) {
+		fprintf(stderr, "codec_init: cannot create coding matrix\n");
+		goto store;
+	}
+
+	/* Cached blocks are only good for this version of the file. */
+	store->key.dev = st.st_dev;
+	store->key.ino = st.st_ino;
+	store->key.size = st.st_size;
+	store->key.mtime = st.st_mtim.tv_sec;
+	store->key.mtime_nsec = st.st_mtim.tv_nsec;
+	store->cache = blkcache_create(cache_budget, store->k,
+				       store->chunk_size);
+	assert(store->cache);
+	store->scratch = malloc((size_t)(store->k + store->m) *
+				store->chunk_size);
+	assert(store->scratch);
+	return store;
+
+store:
+	fountain_store_close(store);
+	return NULL;
+}
+
+void fountain_store_close(struct fountain_store *store)
+{
+	free(store->scratch);
+	if (store->cache) {
+		blkcache_destroy(store->cache);
+		codec_free(&store->codec);
+	}
+	if (store->src_fd >= 0)
+		close(store->src_fd);
+	if (store->packed)
+		fec_close(&store->fec);
+	if (store->blocks)
+		blkdir_close(&store->bd);
+	if (store->part) {
+		__u32 i;
+
+		for (i = 0; store->coding && i < store->num_blocks; i++)
+			free(store->coding[i]);
+		free(store->coding);
+		free(store->held);
+	}
+	if (store->part_fd >= 0)
+		close(store->part_fd);
+	free(store);
+}
+
+__u64 fountain_store_size(const struct fountain_store *store)
+{
+	return store->size;
+}
+
+/* Copy @len bytes from @off on of chunk @idx of @block_id (0..k-1 for
+ * data, k..k+m-1 for coding) into @buf. Returns 0, or -1 if the store
+ * does not hold the chunk or it is corrupt.
+ */
+static int read_chunk(const struct fountain_store *store, __u32 block_id,
+		      int idx, int off, int len, char *buf)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	ssize_t rc;
+	int fd, slot;
+
+	if (store->packed) {
+		slot = fec_slot(&store->fec, idx);
+		if (slot >= 0) {
+			if (!fec_chunk_ok(&store->fec, block_id, slot))
+				return -1;
+			memcpy(buf,
+			       fec_chunk(&store->fec, block_id, slot) + off,
+			       len);
+			return 0;
+		}
+
+		/* The data chunk is in the source, which lacks the padding. */
+		rc = pread(store->src_fd, buf, len,
+			   ((off_t)block_id * store->k + idx) *
+			   store->chunk_size + off);
+		if (rc < 0)
+			return -1;
+		memset(buf + rc, 0, len - rc);
+		return 0;
+	}
+
+	if (store->part) {
+		if (!(store->held[block_id] & (1U << idx)))
+			return -1;
+		if (idx >= store->k) {
+			size_t pos = (size_t)(idx - store->k) *
+				     store->chunk_size + off;
+
+			memcpy(buf, store->coding[block_id] + pos, len);
+			return 0;
+		}
+		rc = pread(store->part_fd, buf, len,
+			   ((off_t)block_id * store->k + idx) *
+			   store->chunk_size + off);
+		return rc == len ? 0 : -1;
+	}
+
+	if (blkdir_chunk_path(&store->bd, block_id, idx, path, sizeof(path)))
+		return -1;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	/* A chunk that was cut short is as good as lost. */
+	if (fstat(fd, &st) < 0 || st.st_size != store->chunk_size) {
+		close(fd);
+		return -1;
+	}
+	rc = pread(fd, buf, len, off);
+	close(fd);
+	return rc == len ? 0 : -1;
+}
+
+/* Rebuild the data chunks of @block_id in the scratch space from the
+ * first k chunks that the store holds.
+ */
+static int decode_block(struct fountain_store *store, __u32 block_id)
+{
+	char *data[store->k], *coding[store->m];
+	int erasures[store->k + store->m + 1];
+	int i, num_erased = 0, held = 0;
+
+	for (i = 0; i < store->k + store->m; i++) {
+		char *chunk = store->scratch + (size_t)i * store->chunk_size;
+
+		if (i < store->k)
+			data[i] = chunk;
+		else
+			coding[i - store->k] = chunk;
+		if (held < store->k &&
+		    !read_chunk(store, block_id, i, 0, store->chunk_size,
+				chunk))
+			held++;
+		else
+			erasures[num_erased++] = i;
+	}
+	erasures[num_erased] = -1;
+
+	if (held < store->k ||
+	    codec_decode(&store->codec, erasures, data, coding,
+			 store->chunk_size) < 0) {
+		fprintf(stderr, "Cannot decode block %u\n", block_id);
+		return -1;
+	}
+	return 0;
+}
+
+/* Copy @len bytes from @off on of the data of @block_id into @buf. */
+static int read_block(struct fountain_store *store, __u32 block_id,
+		      size_t off, size_t len, char *buf)
+{
+	char *data[store->k];
+	size_t pos, n;
+	int i;
+
+	/* Straight from the data chunks, if the store holds them all. */
+	for (pos = 0; pos < len; pos += n) {
+		i = (off + pos) / store->chunk_size;
+		n = store->chunk_size - (off + pos) % store->chunk_size;
+		if (n > len - pos)
+			n = len - pos;
+		if (read_chunk(store, block_id, i,
+			       (off + pos) % store->chunk_size, n, buf + pos))
+			break;
+	}
+	if (pos == len) {
+		store->stats.copied++;
+		return 0;
+	}
+
+	for (i = 0; i < store->k; i++)
+		data[i] = store->scratch + (size_t)i * store->chunk_size;
+	store->key.block_id = block_id;
+	if (blkcache_get(store->cache, &store->key, data)) {
+		store->stats.cached++;
+	} else {
+		if (decode_block(store, block_id)) {
+			store->stats.failed++;
+			return -1;
+		}
+		store->stats.decoded++;
+		blkcache_put(store->cache, &store->key, data);
+	}
+
+	/* The data chunks are contiguous in the scratch space. */
+	memcpy(buf, store->scratch + off, len);
+	return 0;
+}
+
+ssize_t fountain_read_range(struct fountain_store *store, __u64 offset,
+			    size_t len, void *buf)
+{
+	size_t block_size = (size_t)store->k * store->chunk_size;
+	size_t done, n, off;
+
+	if (offset >= store->size)
+		return 0;
+	if (len > store->size - offset)
+		len = store->size - offset;
+
+	for (done = 0; done < len; done += n) {
+		off = (offset + done) % block_size;
+		n = block_size - off;
+		if (n > len - done)
+			n = len - done;
+		if (read_block(store, (offset + done) / block_size, off, n,
+			       (char *)buf + done)) {
+			errno = EIO;
+			return -1;
+		}
+	}
+	return len;
+}
+
+void fountain_store_get_stats(const struct fountain_store *store,
+			      struct fountain_store_stats *st)
+{
+	*st = store->stats;
+}
@@ -0,0 +1,46 @@
+#ifndef _FSTORE_H
+#define _FSTORE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+struct fountain_store_stats {
+	unsigned long	copied;		/* Block reads served by data chunks. */
+	unsigned long	cached;		/* ... by a cached decoded block. */
+	unsigned long	decoded;	/* Blocks decoded. */
+	unsigned long	failed;		/* Blocks missing too many chunks. */
+};
+
+struct fountain_store;
+
+/* Open the file held at @path for random access. @path is either a
+ * packed container (see spray.rb --packed), a directory of received
+ * blocks dir/bN as ./decoder -b reads them, or the partial output
+ * decoded/filename.part of drink, read as its journal lists it at the
+ * time of the call. A parity-only container
+ * takes its data chunks from the source file at @src_path, which may be
+ * NULL otherwise. Up to @cache_budget bytes of decoded blocks are kept
+ * for later reads. The store is not safe to share among threads.
+ */
+struct fountain_store *fountain_store_open(const char *path,
+					   const char *src_path,
+					   size_t cache_budget);
+void fountain_store_close(struct fountain_store *store);
+
+/* Size of the original file, without padding. */
+__u64 fountain_store_size(const struct fountain_store *store);
+
+/* Copy @len bytes of the original file from @offset on into @buf.
+ * Blocks whose data chunks cover the range are copied from directly;
+ * the others are decoded once and cached. Returns the number of bytes
+ * read, which is short only at the end of the file, or -1 with errno
+ * set to EIO if a block of the range cannot be rebuilt.
+ */
+ssize_t fountain_read_range(struct fountain_store *store, __u64 offset,
+			    size_t len, void *buf);
+
+void fountain_store_get_stats(const struct fountain_store *store,
+			      struct fountain_store_stats *st);
+
+#endif /* _FSTORE_H */
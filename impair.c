@@ -0,0 +1,278 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "impair.h"
+#include "prng.h"
+
+#define DEF_REORDER_GAP		3
+
+static double now(void)
+{
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int parse_prob(const char *str, double *p)
+{
+	char *end;
+
+	*p = strtod(str, &end);
+	return end != str && *p >= 0 && *p <= 1 ? 0 : -1;
+}
+
+static int parse_opt(struct impair_cfg *cfg, char *opt)
+{
+	char *val = strchr(opt, '='), *arg;
+
+	if (!val)
+		return -1;
+	*val++ = '\0';
+
+	if (!strcmp(opt, "loss"))
+		return parse_prob(val, &cfg->loss);
+	if (!strcmp(opt, "ge")) {
+		cfg->loss_bad = 1;
+		if (!(arg = strchr(val, ':')))
+			return -1;
+		*arg++ = '\0';
+		if (parse_prob(val, &cfg->p_gb))
+			return -1;
+		val = arg;
+		if ((arg = strchr(val, ':'))) {
+			*arg++ = '\0';
+			if (parse_prob(arg, &cfg->loss_bad))
+				return -1;
+		}
+		return parse_prob(val, &cfg->p_bg);
+	}
+	if (!strcmp(opt, "reorder")) {
+		cfg->reorder_gap = DEF_REORDER_GAP;
+		if ((arg = strchr(val, ':'))) {
+			*arg++ = '\0';
+			if (sscanf(arg, "%u", &cfg->reorder_gap) != 1 ||
+			    !cfg->reorder_gap)
+				return -1;
+		}
+		return parse_prob(val, &cfg->reorder);
+	}
+	if (!strcmp(opt, "dup"))
+		return parse_prob(val, &cfg->dup);
+	if (!strcmp(opt, "jitter")) {
+		if (sscanf(val, "%lf", &cfg->jitter) != 1 || cfg->jitter < 0)
+			return -1;
+		cfg->jitter /= 1000;
+		return 0;
+	}
+	if (!strcmp(opt, "trace")) {
+		cfg->trace = val;
+		return 0;
+	}
+	if (!strcmp(opt, "seed"))
+		return sscanf(val, "%llu", (unsigned long long *)&cfg->seed)
+			== 1 ? 0 : -1;
+	return -1;
+}
+
+int impair_parse(struct impair_cfg *cfg, const char *spec)
+{
+	/* Kept for the lifetime of @cfg, which may point into it. */
+	char *copy = strdup(spec), *opt, *save;
+
+	assert(copy);
+	for (opt = strtok_r(copy, ",", &save); opt;
+	     opt = strtok_r(NULL, ",", &save)) {
+		if (parse_opt(cfg, opt)) {
+			fprintf(stderr, "Invalid impairment: %s\n", opt);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int load_trace(struct impair *imp, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	size_t size = 0;
+	int c;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while ((c = fgetc(f)) != EOF) {
+		if (c != '0' && c != '1')
+			continue;
+		if (imp->trace_len == size) {
+			size = size ? 2 * size : 4096;
+			imp->trace = realloc(imp->trace, size);
+			assert(imp->trace);
+		}
+		imp->trace[imp->trace_len++] = c;
+	}
+	fclose(f);
+	if (!imp->trace_len) {
+		fprintf(stderr, "%s holds no trace\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+int impair_init(struct impair *imp, const struct impair_cfg *cfg)
+{
+	memset(imp, 0, sizeof(*imp));
+	imp->cfg = *cfg;
+	imp->state = prng_seed(cfg->seed);
+	if (cfg->trace)
+		return load_trace(imp, cfg->trace);
+	return 0;
+}
+
+void impair_free(struct impair *imp)
+{
+	free(imp->held);
+	free(imp->trace);
+}
+
+int impair_lose(struct impair *imp)
+{
+	int lost;
+
+	if (imp->trace) {
+		lost = imp->trace[imp->trace_pos] == '1';
+		imp->trace_pos = (imp->trace_pos + 1) % imp->trace_len;
+	} else {
+		double p = imp->bad ? imp->cfg.p_bg : imp->cfg.p_gb;
+
+		if (p && prng_unit(&imp->state) < p)
+			imp->bad = !imp->bad;
+		p = imp->bad ? imp->cfg.loss_bad : imp->cfg.loss;
+		lost = p && prng_unit(&imp->state) < p;
+	}
+	imp->stats.lost += lost;
+	return lost;
+}
+
+static ssize_t send_now(int s, const void *buf, size_t len,
+			const struct sockaddr *dst, socklen_t dst_len)
+{
+	return sendto(s, buf, len, 0, dst, dst_len);
+}
+
+static void hold(struct impair *imp, const void *buf, size_t len,
+		 const struct sockaddr *dst, socklen_t dst_len,
+		 __u64 release_seq, double release_time)
+{
+	struct impair_pkt *pkt;
+
+	assert(len <= IMPAIR_MAX_PKT && dst_len <= sizeof(pkt->dst));
+	if (imp->num_held == imp->max_held) {
+		imp->max_held = imp->max_held ? 2 * imp->max_held : 16;
+		imp->held = realloc(imp->held,
+				    imp->max_held * sizeof(*imp->held));
+		assert(imp->held);
+	}
+	pkt = &imp->held[imp->num_held++];
+	pkt->release_seq = release_seq;
+	pkt->release_time = release_time;
+	pkt->len = len;
+	pkt->dst_len = dst_len;
+	memcpy(&pkt->dst, dst, dst_len);
+	memcpy(pkt->buf, buf, len);
+}
+
+/* Send the held packets that are due, or all of them with @all. */
+static ssize_t release(struct impair *imp, int s, double t, int all)
+{
+	ssize_t rc = 0;
+	unsigned int i = 0;
+
+	while (i < imp->num_held) {
+		struct impair_pkt *pkt = &imp->held[i];
+
+		if (!all && (pkt->release_seq > imp->seq ||
+			     pkt->release_time > t)) {
+			i++;
+			continue;
+		}
+		if (send_now(s, pkt->buf, pkt->len,
+			     (struct sockaddr *)&pkt->dst, pkt->dst_len) < 0)
+			rc = -1;
+		*pkt = imp->held[--imp->num_held];
+	}
+	return rc;
+}
+
+ssize_t impair_send(void *arg, int s, const void *buf, size_t len,
+		    const struct sockaddr *dst, socklen_t dst_len)
+{
+	struct impair *imp = arg;
+	double t = imp->cfg.jitter ? now() : 0;
+	int copies = 1, i;
+	ssize_t rc = len;
+
+	imp->seq++;
+	if (imp->cfg.dup && prng_unit(&imp->state) < imp->cfg.dup) {
+		imp->stats.duplicated++;
+		copies = 2;
+	}
+
+	for (i = 0; i < copies; i++) {
+		__u64 release_seq = imp->seq;
+		double release_time = t;
+
+		if (imp->cfg.reorder &&
+		    prng_unit(&imp->state) < imp->cfg.reorder) {
+			imp->stats.reordered++;
+			release_seq += imp->cfg.reorder_gap;
+		}
+		if (imp->cfg.jitter) {
+			imp->stats.delayed++;
+			release_time += imp->cfg.jitter *
+					prng_unit(&imp->state);
+		}
+
+		if (release_seq == imp->seq && release_time <= t) {
+			if (send_now(s, buf, len, dst, dst_len) < 0)
+				rc = -1;
+		} else {
+			hold(imp, buf, len, dst, dst_len, release_seq,
+			     release_time);
+		}
+	}
+
+	if (imp->num_held && release(imp, s, t, 0) < 0)
+		rc = -1;
+	return rc;
+}
+
+void impair_flush(struct impair *imp, int s)
+{
+	double t = now();
+	unsigned int i;
+
+	/* Wait out the latest release time so jitter stays realistic. */
+	for (i = 0; i < imp->num_held; i++) {
+		double wait = imp->held[i].release_time - t;
+
+		if (wait > 0) {
+			struct timespec ts;
+
+			ts.tv_sec = wait;
+			ts.tv_nsec = (wait - ts.tv_sec) * 1000000000;
+			nanosleep(&ts, NULL);
+			t = now();
+		}
+	}
+	release(imp, s, t, 1);
+}
+
+void impair_print_stats(const struct impair *imp)
+{
+	fprintf(stderr, "Impairments: %lu lost, %lu reordered, "
+		"%lu duplicated, %lu delayed\n", imp->stats.lost,
+		imp->stats.reordered, imp->stats.duplicated,
+		imp->stats.delayed);
+}
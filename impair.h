@@ -0,0 +1,91 @@
+#ifndef _IMPAIR_H
+#define _IMPAIR_H
+
+#include <stddef.h>
+#include <linux/types.h>
+#include "fountain.h"
+
+/* Largest packet that can be held back. */
+#define IMPAIR_MAX_PKT		2048
+
+/* Network impairments applied on the sender side, with probabilities as
+ * fractions. Loss follows a Gilbert-Elliott channel that loses @loss of
+ * the packets in the good state and @loss_bad in the bad one, which is
+ * plain Bernoulli loss while @p_gb is 0, or replays @trace.
+ */
+struct impair_cfg {
+	double		loss;
+	double		p_gb;		/* Good to bad, per packet. */
+	double		p_bg;		/* Bad to good, per packet. */
+	double		loss_bad;
+	double		reorder;	/* Held back behind... */
+	unsigned int	reorder_gap;	/* ...this many later packets. */
+	double		dup;
+	double		jitter;		/* Extra delay in [0, jitter) s. */
+	const char	*trace;
+	__u64		seed;
+};
+
+struct impair_stats {
+	unsigned long	lost;
+	unsigned long	reordered;
+	unsigned long	duplicated;
+	unsigned long	delayed;
+};
+
+struct impair_pkt {
+	double				release_time;
+	__u64				release_seq;
+	size_t				len;
+	socklen_t			dst_len;
+	struct tmp_sockaddr_storage	dst;
+	__u8				buf[IMPAIR_MAX_PKT];
+};
+
+struct impair {
+	struct impair_cfg	cfg;
+	__u64			state;
+	int			bad;
+	char			*trace;
+	size_t			trace_len;
+	size_t			trace_pos;
+	__u64			seq;
+	struct impair_pkt	*held;
+	unsigned int		num_held;
+	unsigned int		max_held;
+	struct impair_stats	stats;
+};
+
+/* Parse a comma separated list of
+ *
+ *	loss=P			Bernoulli loss, or good state loss with ge
+ *	ge=P_GB:P_BG[:LOSS]	Gilbert-Elliott burst loss (LOSS is 1)
+ *	reorder=P[:GAP]		hold packets back behind GAP (3) others
+ *	dup=P			duplicate packets
+ *	jitter=MS		delay packets by up to MS milliseconds
+ *	trace=PATH		replay a loss trace of '0' and '1' (lost)
+ *	seed=N			seed of the generator
+ *
+ * into @cfg, on top of what it already holds. Returns -1 on error.
+ */
+int impair_parse(struct impair_cfg *cfg, const char *spec);
+
+int impair_init(struct impair *imp, const struct impair_cfg *cfg);
+void impair_free(struct impair *imp);
+
+/* Returns 1 if the next packet is lost. */
+int impair_lose(struct impair *imp);
+
+/* Send a packet that was not lost, applying duplication, reordering
+ * and jitter, and send the held packets that are due. It has the type
+ * of fountain_send_fn, so that it can stand in for sendto().
+ */
+ssize_t impair_send(void *arg, int s, const void *buf, size_t len,
+		    const struct sockaddr *dst, socklen_t dst_len);
+
+/* Wait until every packet still held is due, and send them all. */
+void impair_flush(struct impair *imp, int s);
+
+void impair_print_stats(const struct impair *imp);
+
+#endif /* _IMPAIR_H */
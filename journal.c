@@ -0,0 +1,289 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fecfile.h"
+#include "journal.h"
+
+static __u32 rec_crc(const struct journal_rec *rec, const void *payload)
+{
+	struct journal_rec r = *rec;
+
+	r.crc = 0;
+	return fec_crc32c(fec_crc32c(0, &r, sizeof(r)), payload, r.len);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const __u8 *p = buf;
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, p, len);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			return -1;
+		p += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Pass every intact record of the journal in @fd, which is @size bytes
+ * long, to @replay. Returns the length of the intact part.
+ */
+static off_t replay_records(int fd, off_t size, journal_replay_fn replay,
+			    void *arg)
+{
+	const __u8 *map, *p, *end;
+	off_t good = sizeof(struct journal_hdr);
+
+	if (size <= good)
+		return good;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	p = map + good;
+	end = map + size;
+	while (p + sizeof(struct journal_rec) <= end) {
+		struct journal_rec rec;
+
+		memcpy(&rec, p, sizeof(rec));
+		if (p + sizeof(rec) + rec.len > end ||
+		    rec.crc != rec_crc(&rec, p + sizeof(rec)))
+			break;
+		replay(arg, &rec, p + sizeof(rec));
+		p += sizeof(rec) + rec.len;
+	}
+	good = p - map;
+	assert(!munmap((void *)map, size));
+	return good;
+}
+
+/* Resume the journal in @j->fd if it is of the transfer in @hdr.
+ * Returns 1 if it was, 0 if it was not, or -1 on error.
+ */
+static int resume(struct journal *j, const struct journal_hdr *hdr,
+		  journal_replay_fn replay, void *arg)
+{
+	struct journal_hdr old;
+	struct stat st;
+	off_t good;
+
+	if (fstat(j->fd, &st) < 0)
+		return -1;
+	if (st.st_size < (off_t)sizeof(old) ||
+	    pread(j->fd, &old, sizeof(old), 0) != sizeof(old) ||
+	    memcmp(&old, hdr, sizeof(old)))
+		return 0;
+
+	good = replay_records(j->fd, st.st_size, replay, arg);
+	if (good < 0)
+		return -1;
+	/* Appends go after the last intact record. */
+	if (good < st.st_size && ftruncate(j->fd, good) < 0)
+		return -1;
+	if (lseek(j->fd, good, SEEK_SET) < 0)
+		return -1;
+	return 1;
+}
+
+static void *flusher_thread(void *arg);
+
+int journal_open(struct journal *j, const char *path,
+		 const struct journal_hdr *hdr, int data_fd,
+		 journal_replay_fn replay, void *arg)
+{
+	int rc;
+
+	memset(j, 0, sizeof(*j));
+	j->data_fd = data_fd;
+	j->fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (j->fd < 0)
+		goto err;
+
+	rc = resume(j, hdr, replay, arg);
+	if (rc < 0)
+		goto fd;
+	if (!rc) {
+		if (ftruncate(j->fd, 0) < 0 ||
+		    lseek(j->fd, 0, SEEK_SET) < 0 ||
+		    write_all(j->fd, hdr, sizeof(*hdr)) ||
+		    fdatasync(j->fd) < 0)
+			goto fd;
+	}
+
+	j->buf = malloc(JOURNAL_BATCH_BYTES);
+	j->spare = malloc(JOURNAL_BATCH_BYTES);
+	assert(j->buf && j->spare);
+	assert(!pthread_mutex_init(&j->lock, NULL));
+	assert(!pthread_cond_init(&j->wake, NULL));
+	assert(!pthread_cond_init(&j->flushed, NULL));
+	assert(!pthread_create(&j->flusher, NULL, flusher_thread, j));
+	return rc;
+
+fd:
+	close(j->fd);
+err:
+	fprintf(stderr, "%s: errno=%i on %s: %s\n",
+		__func__, errno, path, strerror(errno));
+	return -1;
+}
+
+int journal_read(const char *path, struct journal_hdr *hdr,
+		 journal_replay_fn replay, void *arg)
+{
+	struct stat st;
+	int fd, rc = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0)
+		goto fd;
+	if (st.st_size < (off_t)sizeof(*hdr) ||
+	    pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+	    memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic))) {
+		errno = EINVAL;
+		goto fd;
+	}
+	if (replay && replay_records(fd, st.st_size, replay, arg) < 0)
+		goto fd;
+	rc = 0;
+
+fd:
+	close(fd);
+	return rc;
+}
+
+/* Write the batch in @j->buf. Called with @j->lock held, which is
+ * dropped while the disk is busy, so that records can be added to the
+ * other buffer meanwhile.
+ */
+static void flush_locked(struct journal *j)
+{
+	unsigned long records = j->records;
+	size_t len = j->len;
+	__u8 *batch = j->buf;
+	int rc = 0;
+
+	j->buf = j->spare;
+	j->spare = batch;
+	j->len = 0;
+	/* A full buffer may have held up journal_add(). */
+	assert(!pthread_cond_broadcast(&j->flushed));
+	assert(!pthread_mutex_unlock(&j->lock));
+
+	/* The chunks come first, then the records that point at them. */
+	if (fdatasync(j->data_fd) < 0 || write_all(j->fd, batch, len) ||
+	    fdatasync(j->fd) < 0) {
+		fprintf(stderr, "%s: errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+		rc = -1;
+	}
+
+	assert(!pthread_mutex_lock(&j->lock));
+	if (rc)
+		j->error = 1;
+	j->written = records;
+	j->syncs++;
+	assert(!pthread_cond_broadcast(&j->flushed));
+}
+
+static void *flusher_thread(void *arg)
+{
+	struct journal *j = arg;
+	struct timespec ts;
+
+	assert(!pthread_mutex_lock(&j->lock));
+	while (1) {
+		if (j->len && (j->wanted > j->written || j->closing ||
+			       j->len > JOURNAL_BATCH_BYTES / 2)) {
+			flush_locked(j);
+			continue;
+		}
+		if (j->closing)
+			break;
+
+		assert(!clock_gettime(CLOCK_REALTIME, &ts));
+		ts.tv_nsec += JOURNAL_SYNC_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		if (pthread_cond_timedwait(&j->wake, &j->lock, &ts) ==
+		    ETIMEDOUT && j->len)
+			flush_locked(j);
+	}
+	assert(!pthread_mutex_unlock(&j->lock));
+	return NULL;
+}
+
+int journal_add(struct journal *j, __u32 block_id, int type, int idx,
+		const void *payload, __u16 len)
+{
+	struct journal_rec rec;
+	int rc;
+
+	assert(sizeof(rec) + len <= JOURNAL_BATCH_BYTES);
+	rec.block_id = block_id;
+	rec.type = type;
+	rec.idx = idx;
+	rec.len = len;
+	rec.crc = rec_crc(&rec, payload);
+
+	assert(!pthread_mutex_lock(&j->lock));
+	if (j->len > JOURNAL_BATCH_BYTES / 2)
+		assert(!pthread_cond_signal(&j->wake));
+	/* Only if the disk falls a whole batch behind. */
+	while (j->len + sizeof(rec) + len > JOURNAL_BATCH_BYTES)
+		assert(!pthread_cond_wait(&j->flushed, &j->lock));
+	memcpy(j->buf + j->len, &rec, sizeof(rec));
+	if (len)
+		memcpy(j->buf + j->len + sizeof(rec), payload, len);
+	j->len += sizeof(rec) + len;
+	j->records++;
+	rc = j->error ? -1 : 0;
+	assert(!pthread_mutex_unlock(&j->lock));
+	return rc;
+}
+
+int journal_sync(struct journal *j)
+{
+	int rc;
+
+	assert(!pthread_mutex_lock(&j->lock));
+	j->wanted = j->records;
+	assert(!pthread_cond_signal(&j->wake));
+	while (j->written < j->wanted)
+		assert(!pthread_cond_wait(&j->flushed, &j->lock));
+	rc = j->error ? -1 : 0;
+	assert(!pthread_mutex_unlock(&j->lock));
+	return rc;
+}
+
+int journal_close(struct journal *j)
+{
+	int rc = journal_sync(j);
+
+	assert(!pthread_mutex_lock(&j->lock));
+	j->closing = 1;
+	assert(!pthread_cond_signal(&j->wake));
+	assert(!pthread_mutex_unlock(&j->lock));
+	assert(!pthread_join(j->flusher, NULL));
+
+	if (close(j->fd) < 0)
+		rc = -1;
+	assert(!pthread_cond_destroy(&j->flushed));
+	assert(!pthread_cond_destroy(&j->wake));
+	assert(!pthread_mutex_destroy(&j->lock));
+	free(j->spare);
+	free(j->buf);
+	return rc;
+}
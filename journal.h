@@ -0,0 +1,118 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <linux/types.h>
+
+/* Append-only log of what a receiver holds, kept next to the file it
+ * writes chunks to, in host byte order:
+ *
+ *	struct journal_hdr
+ *	struct journal_rec, each followed by @len bytes of payload
+ *
+ * Records are buffered and written in batches by a flusher thread of
+ * the journal's own, so that adding one never waits for the disk.
+ * Before a batch is written, the data file is synced, so a record never
+ * reaches the disk ahead of the chunk it stands for. A crash loses at
+ * most the batches not yet written; a torn batch is cut off at the
+ * first record that fails its checksum.
+ */
+#define JOURNAL_MAGIC		"FNTNJNL2"
+
+/* A batch is written once it holds this many bytes, or this long
+ * after the last one.
+ */
+#define JOURNAL_BATCH_BYTES	(64 << 10)
+#define JOURNAL_SYNC_MS		100
+
+/* The transfer, file and geometry the journal is for. A journal only
+ * resumes a transfer of the same session of the same file.
+ */
+struct journal_hdr {
+	char	magic[8];
+	char	filename[32];
+	__u32	num_blocks;
+	__u16	padding;
+	__u16	chunk_size;
+	__u16	k;
+	__u16	m;
+	__u32	session;
+};
+
+enum journal_rec_type {
+	/* Chunk @idx of @block_id is in the data file, or, for a coding
+	 * chunk, in the payload.
+	 */
+	JOURNAL_CHUNK = 1,
+	/* The missing data chunks of @block_id were rebuilt in the data
+	 * file.
+	 */
+	JOURNAL_DECODED = 2,
+};
+
+struct journal_rec {
+	__u32	block_id;
+	__u8	type;
+	__u8	idx;
+	__u16	len;
+	/* CRC32C of the record, with @crc 0, and of its payload. */
+	__u32	crc;
+};
+
+struct journal {
+	int		fd;
+	int		data_fd;
+	pthread_t	flusher;
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;		/* Of the flusher. */
+	pthread_cond_t	flushed;
+	/* Protected by @lock. */
+	__u8		*buf;		/* Records not yet written. */
+	size_t		len;
+	__u8		*spare;		/* The batch being written. */
+	unsigned long	records;	/* Added. */
+	unsigned long	written;	/* Of @records, on the disk. */
+	unsigned long	wanted;		/* By journal_sync(). */
+	unsigned long	syncs;
+	int		error;
+	int		closing;
+};
+
+/* Called for every intact record of a journal that is resumed. */
+typedef void (*journal_replay_fn)(void *arg, const struct journal_rec *rec,
+				  const void *payload);
+
+/* Open the journal at @path of a transfer whose chunks are written to
+ * @data_fd. If @path holds a journal of the same transfer as @hdr, its
+ * records are passed to @replay and new ones are appended, and 1 is
+ * returned. Otherwise an empty journal is created in its place and 0
+ * is returned. Returns -1 on error.
+ */
+int journal_open(struct journal *j, const char *path,
+		 const struct journal_hdr *hdr, int data_fd,
+		 journal_replay_fn replay, void *arg);
+
+/* Read the header of the journal at @path into @hdr and, if @replay is
+ * not NULL, pass every intact record to it, without changing the
+ * journal, e.g. to read the partial output of a transfer that is still
+ * going on. Returns -1 on error, with errno set to EINVAL if @path is
+ * not a journal.
+ */
+int journal_read(const char *path, struct journal_hdr *hdr,
+		 journal_replay_fn replay, void *arg);
+
+/* Append a record; @payload may be NULL if @len is 0. Only waits for
+ * the flusher if a whole batch is still being written. Returns -1 if
+ * an earlier batch could not be written.
+ */
+int journal_add(struct journal *j, __u32 block_id, int type, int idx,
+		const void *payload, __u16 len);
+
+/* Wait until the records added so far are written and synced. */
+int journal_sync(struct journal *j);
+
+/* Sync, stop the flusher and close. */
+int journal_close(struct journal *j);
+
+#endif /* _JOURNAL_H */
@@ -0,0 +1,70 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "pktq.h"
+
+int pktq_init(struct pktq *q, unsigned int size, long limit)
+{
+	assert(size > 0);
+	q->committed = calloc(size, sizeof(*q->committed));
+	if (!q->committed)
+		return -1;
+	assert(!pthread_mutex_init(&q->lock, NULL));
+	assert(!pthread_cond_init(&q->not_full, NULL));
+	assert(!pthread_cond_init(&q->ready, NULL));
+	q->size = size;
+	q->limit = limit;
+	q->head = 0;
+	q->tail = 0;
+	return 0;
+}
+
+void pktq_destroy(struct pktq *q)
+{
+	pthread_cond_destroy(&q->ready);
+	pthread_cond_destroy(&q->not_full);
+	pthread_mutex_destroy(&q->lock);
+	free(q->committed);
+}
+
+long pktq_reserve(struct pktq *q)
+{
+	long seq;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->tail < q->limit && q->tail - q->head >= q->size)
+		pthread_cond_wait(&q->not_full, &q->lock);
+	seq = q->tail < q->limit ? q->tail++ : -1;
+	pthread_mutex_unlock(&q->lock);
+	return seq;
+}
+
+void pktq_commit(struct pktq *q, long seq)
+{
+	pthread_mutex_lock(&q->lock);
+	q->committed[seq % q->size] = 1;
+	if (seq == q->head)
+		pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+}
+
+long pktq_peek(struct pktq *q)
+{
+	long seq;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->head < q->limit && !q->committed[q->head % q->size])
+		pthread_cond_wait(&q->ready, &q->lock);
+	seq = q->head < q->limit ? q->head : -1;
+	pthread_mutex_unlock(&q->lock);
+	return seq;
+}
+
+void pktq_release(struct pktq *q)
+{
+	pthread_mutex_lock(&q->lock);
+	assert(q->committed[q->head % q->size]);
+	q->committed[q->head % q->size] = 0;
+	q->head++;
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,41 @@
+#ifndef _PKTQ_H
+#define _PKTQ_H
+
+#include <pthread.h>
+
+/* Bounded queue of @limit items that producers fill out of order and
+ * the consumer drains in order. An item is identified by its sequence
+ * number, and its storage is slot (seq % size) of a caller-owned array,
+ * so at most @size items are ever in flight.
+ */
+struct pktq {
+	pthread_mutex_t	lock;
+	pthread_cond_t	not_full;
+	pthread_cond_t	ready;
+	char		*committed;
+	unsigned int	size;
+	long		limit;
+	long		head;	/* Next item to drain. */
+	long		tail;	/* Next item to hand out to a producer. */
+};
+
+int pktq_init(struct pktq *q, unsigned int size, long limit);
+void pktq_destroy(struct pktq *q);
+
+/* Wait for a free slot and return the sequence number of the item the
+ * caller must now fill, or -1 once all @limit items were handed out.
+ */
+long pktq_reserve(struct pktq *q);
+
+/* Mark item @seq as filled. */
+void pktq_commit(struct pktq *q, long seq);
+
+/* Wait until the next item in order is filled and return its sequence
+ * number, or -1 if all items were drained.
+ */
+long pktq_peek(struct pktq *q);
+
+/* Give the slot of the item returned by pktq_peek() back to producers. */
+void pktq_release(struct pktq *q);
+
+#endif /* _PKTQ_H */
@@ -0,0 +1,28 @@
+#ifndef _PRNG_H
+#define _PRNG_H
+
+#include <linux/types.h>
+
+/* xorshift64*: fast, seedable, and good enough to simulate a network
+ * or shuffle a send order. @state must not be 0.
+ */
+static inline __u64 prng_next(__u64 *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Uniform in [0, 1). */
+static inline double prng_unit(__u64 *state)
+{
+	return (prng_next(state) >> 11) / 9007199254740992.0;
+}
+
+static inline __u64 prng_seed(__u64 seed)
+{
+	return seed ? seed : 1;
+}
+
+#endif /* _PRNG_H */
@@ -0,0 +1,236 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "ratectl.h"
+
+#define RING_SIZE	4096
+
+#define MIN_PPS		100
+#define MAX_PPS		10000000
+
+/* AIMD: halve on a report with more loss than AIMD_LOSS, and otherwise
+ * add AIMD_INC packets per second.
+ */
+#define AIMD_LOSS	0.02
+#define AIMD_INC	500
+
+/* Delay based: steer the queueing delay, the RTT above the smallest
+ * one seen, to DELAY_TARGET seconds, changing the rate by at most
+ * DELAY_GAIN of itself per report.
+ */
+#define DELAY_TARGET	0.025
+#define DELAY_GAIN	0.1
+
+static double now(void)
+{
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void clamp_rate(struct ratectl *rc)
+{
+	if (rc->rate < MIN_PPS)
+		rc->rate = MIN_PPS;
+	else if (rc->rate > MAX_PPS)
+		rc->rate = MAX_PPS;
+}
+
+static void fixed_on_report(struct ratectl *rc, double loss, double rtt)
+{
+	UNUSED(rc);
+	UNUSED(loss);
+	UNUSED(rtt);
+}
+
+static void aimd_on_report(struct ratectl *rc, double loss, double rtt)
+{
+	UNUSED(rtt);
+	if (loss > AIMD_LOSS)
+		rc->rate /= 2;
+	else
+		rc->rate += AIMD_INC;
+}
+
+static void delay_on_report(struct ratectl *rc, double loss, double rtt)
+{
+	double off_target = (DELAY_TARGET - (rtt - rc->min_rtt)) /
+			    DELAY_TARGET;
+
+	/* Loss means the queue overflowed before the delay built up. */
+	if (loss > AIMD_LOSS) {
+		rc->rate /= 2;
+		return;
+	}
+	if (off_target < -1)
+		off_target = -1;
+	rc->rate *= 1 + DELAY_GAIN * off_target;
+}
+
+static const struct ratectl_ops ratectl_algs[] = {
+	{ "fixed",	fixed_on_report },
+	{ "aimd",	aimd_on_report },
+	{ "delay",	delay_on_report },
+};
+
+const struct ratectl_ops *ratectl_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(ratectl_algs) / sizeof(ratectl_algs[0]); i++)
+		if (!strcmp(ratectl_algs[i].name, name))
+			return &ratectl_algs[i];
+	return NULL;
+}
+
+int ratectl_init(struct ratectl *rc, const char *name, double rate)
+{
+	memset(rc, 0, sizeof(*rc));
+	rc->ops = ratectl_find(name);
+	if (!rc->ops)
+		return -1;
+
+	rc->ring = calloc(RING_SIZE, sizeof(*rc->ring));
+	if (!rc->ring)
+		return -1;
+	rc->rate = rate;
+	clamp_rate(rc);
+	rc->code_chunks = CODE_FILES_PER_BLOCK;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &rc->next));
+	return 0;
+}
+
+void ratectl_free(struct ratectl *rc)
+{
+	free(rc->ring);
+}
+
+/* Sleeping until an absolute deadline keeps the rate from drifting with
+ * the time it takes to send each packet. After a pause, the deadline
+ * restarts from now instead of bursting to catch up.
+ */
+void ratectl_pace(struct ratectl *rc)
+{
+	struct timespec now;
+
+	assert(!clock_gettime(CLOCK_MONOTONIC, &now));
+	if (now.tv_sec > rc->next.tv_sec ||
+	    (now.tv_sec == rc->next.tv_sec && now.tv_nsec > rc->next.tv_nsec))
+		rc->next = now;
+
+	rc->next.tv_nsec += 1000000000 / rc->rate;
+	while (rc->next.tv_nsec >= 1000000000) {
+		rc->next.tv_nsec -= 1000000000;
+		rc->next.tv_sec++;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &rc->next,
+			       NULL) == EINTR)
+		;
+}
+
+void ratectl_sent(struct ratectl *rc, __u32 block_id, __s16 chunk_id)
+{
+	struct ratectl_sent *sent = &rc->ring[rc->num_sent % RING_SIZE];
+
+	sent->block_id = block_id;
+	sent->chunk_id = chunk_id;
+	sent->seq = ++rc->num_sent;
+	sent->time = now();
+}
+
+/* The newest packet sent for @block_id and @chunk_id, or NULL if it
+ * is no longer in the ring.
+ */
+static const struct ratectl_sent *find_sent(const struct ratectl *rc,
+					    __u32 block_id, __s16 chunk_id)
+{
+	__u64 n = rc->num_sent < RING_SIZE ? rc->num_sent : RING_SIZE;
+	__u64 i;
+
+	for (i = 0; i < n; i++) {
+		const struct ratectl_sent *sent =
+			&rc->ring[(rc->num_sent - 1 - i) % RING_SIZE];
+
+		if (sent->block_id == block_id && sent->chunk_id == chunk_id)
+			return sent;
+	}
+	return NULL;
+}
+
+void ratectl_report(struct ratectl *rc, const struct fountain_report *rep)
+{
+	const struct ratectl_sent *sent = find_sent(rc, rep->echo_block,
+						    rep->echo_chunk);
+	double rtt, loss = 0;
+
+	if (!sent)
+		return;
+
+	/* The receiver held the echoed packet for @hold_us before it
+	 * sent the report.
+	 */
+	rtt = now() - sent->time - rep->hold_us / 1000000.0;
+	if (rtt < 0)
+		rtt = 0;
+	if (!rc->min_rtt || rtt < rc->min_rtt)
+		rc->min_rtt = rtt;
+	rc->srtt = rc->srtt ? 0.875 * rc->srtt + 0.125 * rtt : rtt;
+
+	/* Every packet up to the echoed one had its chance to arrive. */
+	if (rc->have_last && sent->seq > rc->last_seq) {
+		double num_sent = sent->seq - rc->last_seq;
+		double num_recv = (__u32)(rep->num_recv - rc->last_recv);
+
+		loss = num_recv < num_sent ? 1 - num_recv / num_sent : 0;
+	}
+	rc->last_seq = sent->seq;
+	rc->last_recv = rep->num_recv;
+	rc->have_last = 1;
+
+	rc->loss = rc->num_reports ? 0.875 * rc->loss + 0.125 * loss : loss;
+	rc->num_reports++;
+	rc->ops->on_report(rc, loss, rtt);
+	clamp_rate(rc);
+
+	if (rc->target)
+		rc->code_chunks = ratectl_code_chunks(DATA_FILES_PER_BLOCK,
+						      CODE_FILES_PER_BLOCK,
+						      rc->loss, rc->target);
+}
+
+void ratectl_set_target(struct ratectl *rc, double target)
+{
+	rc->target = target;
+}
+
+/* P(X >= k) for X ~ Binomial(n, q). */
+static double binomial_tail(int n, int k, double q)
+{
+	double pmf = 1, tail = 0;
+	int i;
+
+	/* pmf(0) = (1 - q)^n, then pmf(i) from pmf(i - 1). */
+	for (i = 0; i < n; i++)
+		pmf *= 1 - q;
+	for (i = 0; i <= n; i++) {
+		if (i >= k)
+			tail += pmf;
+		pmf *= (double)(n - i) / (i + 1) * q / (1 - q);
+	}
+	return tail;
+}
+
+int ratectl_code_chunks(int k, int m, double loss, double target)
+{
+	int n;
+
+	if (loss <= 0)
+		return 0;
+	if (loss >= 1)
+		return m;
+	for (n = k; n < k + m; n++)
+		if (binomial_tail(n, k, 1 - loss) >= target)
+			break;
+	return n - k;
+}
@@ -0,0 +1,87 @@
+#ifndef _RATECTL_H
+#define _RATECTL_H
+
+#include <time.h>
+#include <linux/types.h>
+#include "fountain.h"
+
+#define RATECTL_DEF_PPS		10000
+
+struct ratectl;
+
+/* A rate control algorithm. @on_report is called for every receiver
+ * report with the fraction of packets lost since the previous report,
+ * and @rtt, the round-trip time of the echoed packet in seconds.
+ */
+struct ratectl_ops {
+	const char	*name;
+	void		(*on_report)(struct ratectl *rc, double loss,
+				     double rtt);
+};
+
+/* Send time of a recent packet, to match receiver echoes against. */
+struct ratectl_sent {
+	__u32	block_id;
+	__s16	chunk_id;
+	__u64	seq;
+	double	time;
+};
+
+struct ratectl {
+	const struct ratectl_ops *ops;
+	double			rate;		/* Packets per second. */
+	struct timespec		next;
+
+	struct ratectl_sent	*ring;
+	__u64			num_sent;
+
+	/* State of the last report that matched a sent packet. */
+	__u64			last_seq;
+	__u32			last_recv;
+	int			have_last;
+
+	double			min_rtt;	/* 0 until the first sample. */
+	double			srtt;
+	unsigned long		num_reports;
+	double			loss;		/* Smoothed. */
+
+	/* Coding chunks to send per block, and the probability that a
+	 * block completes without repair that they are chosen for, or 0
+	 * to always send all of them.
+	 */
+	int			code_chunks;
+	double			target;
+};
+
+/* The algorithm called @name, or NULL if there is none. */
+const struct ratectl_ops *ratectl_find(const char *name);
+
+/* Pick the algorithm called @name ("fixed", "aimd" or "delay"), starting
+ * at @rate packets per second. Returns -1 if @name is unknown.
+ */
+int ratectl_init(struct ratectl *rc, const char *name, double rate);
+void ratectl_free(struct ratectl *rc);
+
+/* Wait until the next packet may leave. */
+void ratectl_pace(struct ratectl *rc);
+
+/* Record that the packet of @chunk_id of @block_id went out, or was
+ * dropped by the simulated failure rate.
+ */
+void ratectl_sent(struct ratectl *rc, __u32 block_id, __s16 chunk_id);
+
+/* Send only as many coding chunks per block as the loss reported so
+ * far calls for to complete a block with probability @target.
+ */
+void ratectl_set_target(struct ratectl *rc, double target);
+
+/* The fewest of @m coding chunks that complete a block of @k data
+ * chunks with probability @target when each packet is lost with
+ * probability @loss.
+ */
+int ratectl_code_chunks(int k, int m, double loss, double target);
+
+/* Feed a receiver report, in host byte order, to the algorithm. */
+void ratectl_report(struct ratectl *rc, const struct fountain_report *rep);
+
+#endif /* _RATECTL_H */
@@ -0,0 +1,18 @@
+#include <stdlib.h>
+#include <string.h>
+#include "recvmap.h"
+
+int recvmap_init(struct recvmap *rm, __u32 num_blocks)
+{
+	memset(rm, 0, sizeof(*rm));
+	rm->masks = calloc(num_blocks, sizeof(*rm->masks));
+	if (!rm->masks)
+		return -1;
+	rm->num_blocks = num_blocks;
+	return 0;
+}
+
+void recvmap_free(struct recvmap *rm)
+{
+	free(rm->masks);
+}
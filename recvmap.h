@@ -0,0 +1,97 @@
+#ifndef _RECVMAP_H
+#define _RECVMAP_H
+
+#include <linux/types.h>
+#include "fountain.h"
+
+#define CHUNKS_PER_BLOCK	(DATA_FILES_PER_BLOCK + CODE_FILES_PER_BLOCK)
+
+/* Set in the mask of a block once it holds DATA_FILES_PER_BLOCK chunks,
+ * so that later chunks of the block are turned away with a single test.
+ */
+#define RECVMAP_DONE		(1U << 31)
+
+#if CHUNKS_PER_BLOCK > 31
+#error "A block must fit in the mask of struct recvmap"
+#endif
+
+/* Which chunks of every block of a file a receiver holds: bit i of a
+ * mask stands for chunk i of the block, data chunks first, then coding
+ * chunks, as in struct fountain_nack. Four bytes per block.
+ */
+struct recvmap {
+	__u32		*masks;
+	__u32		num_blocks;
+	__u32		num_done;
+	unsigned long	dups;		/* Chunks received twice. */
+	unsigned long	unneeded;	/* Chunks of complete blocks. */
+};
+
+enum recvmap_result {
+	RECVMAP_DUP,		/* Held already, or the block is complete. */
+	RECVMAP_NEW,
+	RECVMAP_COMPLETE,	/* The chunk completed its block. */
+};
+
+int recvmap_init(struct recvmap *rm, __u32 num_blocks);
+void recvmap_free(struct recvmap *rm);
+
+/* Map a chunk ID from the wire (1..k for data, -1..-m for code)
+ * to its index in the block, or -1 if it is out of range.
+ */
+static inline int recvmap_index(__s16 chunk_id)
+{
+	if (chunk_id > 0 && chunk_id <= DATA_FILES_PER_BLOCK)
+		return chunk_id - 1;
+	if (chunk_id < 0 && -chunk_id <= CODE_FILES_PER_BLOCK)
+		return DATA_FILES_PER_BLOCK - chunk_id - 1;
+	return -1;
+}
+
+/* Record chunk @idx of @block_id, which must be in range. */
+static inline enum recvmap_result recvmap_add(struct recvmap *rm,
+					      __u32 block_id, int idx)
+{
+	__u32 *mask = &rm->masks[block_id];
+
+	if (*mask & RECVMAP_DONE) {
+		rm->unneeded++;
+		return RECVMAP_DUP;
+	}
+	if (*mask & (1U << idx)) {
+		rm->dups++;
+		return RECVMAP_DUP;
+	}
+
+	*mask |= 1U << idx;
+	if (__builtin_popcount(*mask) < DATA_FILES_PER_BLOCK)
+		return RECVMAP_NEW;
+	*mask |= RECVMAP_DONE;
+	rm->num_done++;
+	return RECVMAP_COMPLETE;
+}
+
+/* Mark every data chunk of @block_id held, as after they are rebuilt,
+ * and the block complete.
+ */
+static inline void recvmap_set_data(struct recvmap *rm, __u32 block_id)
+{
+	__u32 *mask = &rm->masks[block_id];
+
+	if (!(*mask & RECVMAP_DONE))
+		rm->num_done++;
+	*mask |= RECVMAP_DONE | ((1U << DATA_FILES_PER_BLOCK) - 1);
+}
+
+static inline int recvmap_done(const struct recvmap *rm, __u32 block_id)
+{
+	return !!(rm->masks[block_id] & RECVMAP_DONE);
+}
+
+/* The chunks held of @block_id, without the done flag. */
+static inline __u32 recvmap_mask(const struct recvmap *rm, __u32 block_id)
+{
+	return rm->masks[block_id] & ~RECVMAP_DONE;
+}
+
+#endif /* _RECVMAP_H */
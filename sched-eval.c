@@ -0,0 +1,121 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/types.h>
+#include "sched.h"
+#include "impair.h"
+
+#define USAGE	"usage:\t./sched-eval [-n blocks] [-w window-blocks] "\
+		"[-r runs] [-I impairments]\n"
+
+/* Bursts of 10 lost packets on average, once every 100 packets. */
+#define DEF_IMPAIR	"ge=0.01:0.1"
+
+#define CHUNKS_PER_BLOCK	(DATA_FILES_PER_BLOCK + CODE_FILES_PER_BLOCK)
+
+static const char * const orders[] = { "chunk", "block", "window", "random" };
+
+struct result {
+	double	unrecoverable;
+	double	complete_at;	/* Sum over the complete runs. */
+	int	num_complete;
+};
+
+/* One pass of @sc over @imp. Every block needs DATA_FILES_PER_BLOCK of
+ * its chunks, and the pass is complete at the position of the packet
+ * that completes the last block.
+ */
+static void run_pass(const struct sched *sc, struct impair *imp,
+		     int *num_recv, struct result *res)
+{
+	__u32 num_done = 0, i;
+	__u64 pos;
+
+	memset(num_recv, 0, sc->num_blocks * sizeof(*num_recv));
+	for (pos = 0; pos < sc->len; pos++) {
+		__u32 block_id;
+		int idx;
+
+		sched_at(sc, pos, &block_id, &idx);
+		if (impair_lose(imp))
+			continue;
+		if (++num_recv[block_id] == DATA_FILES_PER_BLOCK &&
+		    ++num_done == sc->num_blocks) {
+			res->complete_at += (double)(pos + 1) / sc->len;
+			res->num_complete++;
+		}
+	}
+	for (i = 0; i < sc->num_blocks; i++)
+		if (num_recv[i] < DATA_FILES_PER_BLOCK)
+			res->unrecoverable++;
+}
+
+int main(int argc, char *argv[])
+{
+	struct impair_cfg cfg;
+	__u32 num_blocks = 1000, depth = 16;
+	unsigned int num_runs = 100, i, r;
+	int *num_recv, opt;
+
+	memset(&cfg, 0, sizeof(cfg));
+	assert(!impair_parse(&cfg, DEF_IMPAIR));
+
+	while ((opt = getopt(argc, argv, "n:w:r:I:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num_blocks = atoi(optarg);
+			break;
+		case 'w':
+			depth = atoi(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		case 'I':
+			memset(&cfg, 0, sizeof(cfg));
+			if (impair_parse(&cfg, optarg))
+				return 1;
+			break;
+		default:
+			printf(USAGE);
+			return 1;
+		}
+	}
+	if (optind != argc || !num_blocks || !depth || !num_runs) {
+		printf(USAGE);
+		return 1;
+	}
+
+	num_recv = malloc(num_blocks * sizeof(*num_recv));
+	assert(num_recv);
+
+	printf("%-8s %16s %16s %12s\n", "order", "unrecoverable",
+	       "complete at", "complete");
+	for (i = 0; i < sizeof(orders) / sizeof(orders[0]); i++) {
+		struct result res;
+		struct impair imp;
+		struct sched sc;
+
+		assert(!sched_init(&sc, orders[i], num_blocks,
+				   CHUNKS_PER_BLOCK, depth, cfg.seed));
+		memset(&res, 0, sizeof(res));
+
+		/* Every order sees the same losses. */
+		if (impair_init(&imp, &cfg))
+			return 1;
+		for (r = 0; r < num_runs; r++)
+			run_pass(&sc, &imp, num_recv, &res);
+
+		printf("%-8s %16.2f %15.1f%% %11.1f%%\n", orders[i],
+		       res.unrecoverable / num_runs, res.num_complete
+		       ? 100 * res.complete_at / res.num_complete : 0,
+		       100.0 * res.num_complete / num_runs);
+		impair_free(&imp);
+		sched_free(&sc);
+	}
+
+	free(num_recv);
+	return 0;
+}
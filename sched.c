@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sched.h"
+#include "prng.h"
+
+static void chunk_at(const struct sched *sc, __u64 pos, __u32 *block_id,
+		     int *idx)
+{
+	*block_id = pos % sc->num_blocks;
+	*idx = pos / sc->num_blocks;
+}
+
+static void block_at(const struct sched *sc, __u64 pos, __u32 *block_id,
+		     int *idx)
+{
+	*block_id = pos / sc->per_block;
+	*idx = pos % sc->per_block;
+}
+
+/* The last window may hold fewer than @depth blocks. */
+static void window_at(const struct sched *sc, __u64 pos, __u32 *block_id,
+		      int *idx)
+{
+	__u64 window_len = (__u64)sc->depth * sc->per_block;
+	__u32 first = pos / window_len * sc->depth;
+	__u32 nb = sc->num_blocks - first < sc->depth
+		? sc->num_blocks - first : sc->depth;
+	__u64 off = pos % window_len;
+
+	*block_id = first + off % nb;
+	*idx = off / nb;
+}
+
+static void random_at(const struct sched *sc, __u64 pos, __u32 *block_id,
+		      int *idx)
+{
+	block_at(sc, sc->perm[pos], block_id, idx);
+}
+
+static const struct sched_ops sched_orders[] = {
+	{ "chunk",	chunk_at },
+	{ "block",	block_at },
+	{ "window",	window_at },
+	{ "random",	random_at },
+};
+
+const struct sched_ops *sched_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(sched_orders) / sizeof(sched_orders[0]); i++)
+		if (!strcmp(sched_orders[i].name, name))
+			return &sched_orders[i];
+	return NULL;
+}
+
+static int shuffle(struct sched *sc, __u64 seed)
+{
+	__u64 state = prng_seed(seed);
+	__u64 i;
+
+	if (sc->len > (__u32)-1)
+		return -1;
+	sc->perm = malloc(sc->len * sizeof(*sc->perm));
+	if (!sc->perm)
+		return -1;
+
+	/* Fisher-Yates. */
+	for (i = 0; i < sc->len; i++)
+		sc->perm[i] = i;
+	for (i = sc->len - 1; i > 0; i--) {
+		__u64 j = prng_next(&state) % (i + 1);
+		__u32 tmp = sc->perm[i];
+
+		sc->perm[i] = sc->perm[j];
+		sc->perm[j] = tmp;
+	}
+	return 0;
+}
+
+int sched_init(struct sched *sc, const char *name, __u32 num_blocks,
+	       int per_block, __u32 depth, __u64 seed)
+{
+	memset(sc, 0, sizeof(*sc));
+	sc->ops = sched_find(name);
+	if (!sc->ops || !num_blocks || per_block <= 0 || !depth)
+		return -1;
+	sc->num_blocks = num_blocks;
+	sc->per_block = per_block;
+	sc->depth = depth;
+	sc->len = (__u64)num_blocks * per_block;
+
+	if (sc->ops->at == random_at)
+		return shuffle(sc, seed);
+	return 0;
+}
+
+void sched_free(struct sched *sc)
+{
+	free(sc->perm);
+}
@@ -0,0 +1,45 @@
+#ifndef _FOUNTAIN_SCHED_H
+#define _FOUNTAIN_SCHED_H
+
+#include <linux/types.h>
+
+/* Send orders of the chunks of a file. Position @pos of a pass maps to
+ * chunk @idx (0..per_block-1, data chunks first) of block @block_id,
+ * and every chunk of every block comes up exactly once per pass:
+ *
+ *	chunk	chunk 0 of every block, then chunk 1, and so on
+ *	block	every chunk of block 0, then of block 1, and so on
+ *	window	chunk order within windows of @depth blocks
+ *	random	a random permutation drawn from @seed
+ */
+struct sched;
+
+struct sched_ops {
+	const char	*name;
+	void		(*at)(const struct sched *sc, __u64 pos,
+			      __u32 *block_id, int *idx);
+};
+
+struct sched {
+	const struct sched_ops	*ops;
+	__u32			num_blocks;
+	int			per_block;
+	__u32			depth;
+	__u64			len;
+	__u32			*perm;
+};
+
+/* The order called @name, or NULL if there is none. */
+const struct sched_ops *sched_find(const char *name);
+
+int sched_init(struct sched *sc, const char *name, __u32 num_blocks,
+	       int per_block, __u32 depth, __u64 seed);
+void sched_free(struct sched *sc);
+
+static inline void sched_at(const struct sched *sc, __u64 pos,
+			    __u32 *block_id, int *idx)
+{
+	sc->ops->at(sc, pos, block_id, idx);
+}
+
+#endif /* _FOUNTAIN_SCHED_H */
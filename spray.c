@@ -4,16 +4,31 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include "fountain.h"
-
-#define USAGE	"usage:\t./spray srv-bind-addr srv-dst-addr "\
-		"file-path padding failure-rate\n"
+#include "fecfile.h"
+#include "arena.h"
+#include "feedback.h"
+#include "ratectl.h"
+#include "sched.h"
+#include "impair.h"
+
+#define USAGE	"usage:\t./spray [-F] [-L linger-s] [-R fixed|aimd|delay] "\
+		"[-p pps | -C carousel-pps]\n\t\t[-A target] "\
+		"[-s chunk|block|window|random] [-w window-blocks]\n"\
+		"\t\t[-P shard/shards] [-i session] [-I impairments] "\
+		"srv-bind-addr\n\t\tsrv-dst-addr file-path padding "\
+		"failure-rate\n"
 
 #define CODING_META_INFO_FILE_LEN	4
 #define META_FILENAME			"meta.txt"
+#define INDEX_FILENAME			"index.txt"
 #define ENCODED_DIR			"encoded"
+#define DEF_LINGER			5
+#define DEF_DEPTH			16
+#define SCHED_SEED			1
 
 static int get_num_blocks(const char *filename)
 {
@@ -50,179 +65,662 @@ static int get_num_blocks(const char *filename)
 	return num_blocks;
 }
 
+/* Where the chunks of the file being sprayed come from: one file per
+ * chunk under encoded/<file>/, or the packed container
+ * encoded/<file>.fec. Parity-only stores of either kind leave the
+ * data chunks to be read from the source file through @src_fd.
+ */
+struct chunk_store {
+	const char		*filename;
+	__u32			num_blocks;
+	__u16			padding;
+	int			src_fd;
+	int			packed;
+	struct fec_file		fec;
+	struct fountain_hdr	hdr;
+	unsigned int		num_corrupt;
+	/* Chunks are read here, not on the stack. */
+	struct arena		arena;
+	__u8			*chunk;
+};
+
+/* Open the source file of a parity-only store, and check that it is
+ * the version that the store was encoded from.
+ */
+static int open_source(const char *file_path, long size, long mtime)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(file_path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: open errno=%i on %s: %s\n",
+			__func__, errno, file_path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size != size ||
+	    st.st_mtime != mtime) {
+		fprintf(stderr, "%s changed since it was encoded\n",
+			file_path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Returns 0 if @store is not parity-only, 1 if it is and the source is
+ * open, or -1 on error.
+ */
+static int open_parity_source(struct chunk_store *store,
+			      const char *file_path)
+{
+	char *index_file_path;
+	char mode[16];
+	FILE *index_file;
+	long size, mtime;
+	int rc;
+
+	rc = asprintf(&index_file_path, "%s/%s/%s", ENCODED_DIR,
+		      store->filename, INDEX_FILENAME);
+	if (rc == -1) {
+		fprintf(stderr,
+			"asprintf: cannot allocate index path string\n");
+		return -1;
+	}
+
+	if (!file_exists(index_file_path)) {
+		free(index_file_path);
+		return 0;
+	}
+
+	index_file = fopen(index_file_path, "r");
+	free(index_file_path);
+	if (!index_file) {
+		fprintf(stderr, "fopen: cannot open index file\n");
+		return -1;
+	}
+	rc = fscanf(index_file, "%15s %ld %ld", mode, &size, &mtime);
+	fclose(index_file);
+	if (rc != 3 || strcmp(mode, "parity")) {
+		fprintf(stderr, "fscanf: bad index file\n");
+		return -1;
+	}
+
+	store->src_fd = open_source(file_path, size, mtime);
+	return store->src_fd < 0 ? -1 : 1;
+}
+
+/* Map the packed container of the file, if there is one. Returns 1 if
+ * it is open, 0 if there is none, or -1 on error.
+ */
+static int open_packed(struct chunk_store *store, const char *file_path)
+{
+	const struct fec_hdr *hdr;
+	char *fec_path;
+	int rc;
+
+	rc = asprintf(&fec_path, "%s/%s.fec", ENCODED_DIR, store->filename);
+	if (rc == -1) {
+		fprintf(stderr,
+			"asprintf: cannot allocate container path string\n");
+		return -1;
+	}
+	if (!file_exists(fec_path)) {
+		free(fec_path);
+		return 0;
+	}
+
+	rc = fec_open(&store->fec, fec_path);
+	if (rc < 0) {
+		fprintf(stderr, "%s: cannot open %s: %s\n",
+			__func__, fec_path, strerror(errno));
+		free(fec_path);
+		return -1;
+	}
+	free(fec_path);
+
+	hdr = store->fec.hdr;
+	if (hdr->k != DATA_FILES_PER_BLOCK ||
+	    hdr->m != CODE_FILES_PER_BLOCK || hdr->chunk_size != CHUNK_SIZE ||
+	    !hdr->num_blocks) {
+		fprintf(stderr, "%s.fec was encoded with other parameters\n",
+			store->filename);
+		goto fec;
+	}
+	store->num_blocks = hdr->num_blocks;
+
+	if (hdr->flags & FEC_F_PARITY_ONLY) {
+		store->src_fd = open_source(file_path, hdr->orig_size,
+					    hdr->src_mtime);
+		if (store->src_fd < 0)
+			goto fec;
+	}
+	store->packed = 1;
+	return 1;
+
+fec:
+	fec_close(&store->fec);
+	return -1;
+}
+
+static int open_store(struct chunk_store *store, const char *file_path,
+		      __u16 padding)
+{
+	char *encoded_file_path;
+	int rc;
+
+	memset(store, 0, sizeof(*store));
+	store->filename = basename(file_path);
+	store->padding = padding;
+	store->src_fd = -1;
+	/* The header has no room for more, and a cut name is another file. */
+	if (strlen(store->filename) > FILENAME_MAX_LEN) {
+		fprintf(stderr, "%s: file names are limited to %d characters\n",
+			store->filename, FILENAME_MAX_LEN);
+		return -1;
+	}
+
+	rc = open_packed(store, file_path);
+	if (rc < 0)
+		return -1;
+	if (rc > 0)
+		goto out;
+
+	rc = asprintf(&encoded_file_path, "%s/%s", ENCODED_DIR,
+		      store->filename);
+	if (rc == -1) {
+		fprintf(stderr,
+			"asprintf: cannot allocate encoded file path\n");
+		return -1;
+	}
+
+	/* Check if a directory for that name exists. */
+	rc = dir_exists(encoded_file_path);
+	free(encoded_file_path);
+	if (!rc) {
+		fprintf(stderr,
+			"invalid request; %s encoding does not exist\n",
+			store->filename);
+		return -1;
+	}
+
+	rc = get_num_blocks(store->filename);
+	if (rc == -1) {
+		fprintf(stderr,
+			"get_num_blocks: cannot find number of blocks\n");
+		return -1;
+	}
+	store->num_blocks = rc;
+
+	/* A parity-only store reads the data chunks from the source. */
+	if (open_parity_source(store, file_path) < 0)
+		return -1;
+
+out:
+	fountain_hdr_init(&store->hdr, store->filename, store->num_blocks,
+			  padding);
+	arena_init(&store->arena, ARENA_PAGE_SIZE, 0);
+	store->chunk = arena_alloc(&store->arena, CHUNK_SIZE);
+	assert(store->chunk);
+	return 0;
+}
+
+static void close_store(struct chunk_store *store)
+{
+	arena_destroy(&store->arena);
+	if (store->packed)
+		fec_close(&store->fec);
+	if (store->src_fd >= 0)
+		close(store->src_fd);
+}
+
+/* Send data chunk @chunk_id of @block_id straight from the source
+ * file; the part of the last block past the end of the file is
+ * padded with zeros.
+ */
+static void send_source_chunk(int s, const struct sockaddr *cli, int cli_len,
+			      struct chunk_store *store, __u32 block_id,
+			      __s16 chunk_id)
+{
+	__u8 *chunk = store->chunk;
+	off_t off = (off_t)block_id * BLOCK_SIZE + (chunk_id - 1) * CHUNK_SIZE;
+	ssize_t rc;
+
+	rc = pread(store->src_fd, chunk, CHUNK_SIZE, off);
+	if (rc < 0) {
+		fprintf(stderr, "%s: pread errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+		exit(1);
+	}
+	memset(chunk + rc, 0, CHUNK_SIZE - rc);
+
+	send_chunk(s, cli, cli_len, &store->hdr, block_id, chunk_id, chunk,
+		   CHUNK_SIZE);
+}
+
+/* Send chunk file @chunk_path, read into @store->chunk. */
 static void send_file(int s, const struct sockaddr *cli, int cli_len,
-		      const char *filename, const char *chunk_path,
-		      __u32 num_blocks, __u32 block_id,
-		      __s16 chunk_id, __u16 padding) 
+		      struct chunk_store *store, const char *chunk_path,
+		      __u32 block_id, __s16 chunk_id)
 {
 	FILE *chunk;
-	struct fountain_hdr *fountain;
-	long file_size;
 	size_t bytes_read;
-	size_t filename_len;
-	ssize_t rc;
-	__u16 packet_len;
 
 	chunk = fopen(chunk_path, "rb");
 	assert(chunk);
-	fseek(chunk, 0, SEEK_END);
-	file_size = ftell(chunk);
-	fseek(chunk, 0, SEEK_SET);
-
-	packet_len = sizeof(*fountain) + file_size;
-	fountain = alloca(packet_len);
-
-	fountain->num_blocks = htonl(num_blocks);
-	fountain->block_id = htonl(block_id);
-	fountain->chunk_id = htons(chunk_id);
-	fountain->packet_len = htons(packet_len);
-	fountain->padding = htons(padding);
-
-	filename_len = strlen(filename);
-	strncpy(fountain->filename, filename,
-		filename_len > FILENAME_MAX_LEN
-		? FILENAME_MAX_LEN
-		: filename_len);
-	memset(fountain->filename + filename_len, 0,
-	       FILENAME_MAX_LEN - filename_len);
-
-	bytes_read = fread(fountain->data, 1, file_size, chunk);
+	bytes_read = fread(store->chunk, 1, CHUNK_SIZE, chunk);
 	assert(!ferror(chunk));
-	assert(bytes_read <= CHUNK_SIZE);
-
-	rc = sendto(s, fountain, packet_len, 0, cli, cli_len);
-	if (rc < 0) {
-		fprintf(stderr, "%s: sendto errno=%i: %s\n",
-			__func__, errno, strerror(errno));
-		fclose(chunk);
-		exit(1);
-	}
 	fclose(chunk);
+
+	send_chunk(s, cli, cli_len, &store->hdr, block_id, chunk_id,
+		   store->chunk, bytes_read);
 }
 
-static unsigned int send_files(int s, const struct sockaddr *cli, int cli_len,
-			       const char *filename, const char *prefix,
-			       __u32 num_blocks, __u32 files_per_block,
-			       __u16 padding, int send_data, unsigned int fr)
+/* Send one chunk from wherever @store keeps it. Returns -1 on error. */
+static int send_store_chunk(int s, const struct sockaddr *cli, int cli_len,
+			    struct chunk_store *store, __u32 block_id,
+			    __s16 chunk_id)
 {
-	unsigned int i, j;
+	char *chunk_path;
 	int size;
-	unsigned int num_dropped = 0;
-
-	/* Loop over all blocks. */
-	for (i = 1; i <= files_per_block; i++) {
-		__s16 chunk_id = send_data ? i : -i;
-		for (j = 0; j < num_blocks; j++) {
-			char *chunk_path;
-			size = asprintf(&chunk_path, "%s/%s/b%0*d/%s%0*d",
-					ENCODED_DIR, filename,
-					num_digits(num_blocks - 1), j,
-					prefix,
-					num_digits(DATA_FILES_PER_BLOCK), i);
-			if (size == -1) {
-				fprintf(stderr,
-					"asprintf: cannot alloc chunk path\n");
-				return -1;
-			}
 
-			usleep(100);
-			if ((unsigned)rand() % 100 >= fr)
-				send_file(s, cli, cli_len, filename, chunk_path,
-					  num_blocks, j, chunk_id, padding);
-			else
-				num_dropped++;
+	if (chunk_id > 0 && store->src_fd >= 0) {
+		send_source_chunk(s, cli, cli_len, store, block_id, chunk_id);
+		return 0;
+	}
+
+	if (store->packed) {
+		int idx = chunk_id > 0 ? chunk_id - 1
+				       : DATA_FILES_PER_BLOCK - chunk_id - 1;
+		int slot = fec_slot(&store->fec, idx);
+
+		assert(slot >= 0);
+		if (!fec_chunk_ok(&store->fec, block_id, slot)) {
+			/* Let the receiver rebuild it from other chunks. */
+			store->num_corrupt++;
+			return 0;
 		}
+		send_chunk(s, cli, cli_len, &store->hdr, block_id, chunk_id,
+			   fec_chunk(&store->fec, block_id, slot), CHUNK_SIZE);
+		return 0;
+	}
+
+	size = asprintf(&chunk_path, "%s/%s/b%0*d/%s%0*d",
+			ENCODED_DIR, store->filename,
+			num_digits(store->num_blocks - 1), block_id,
+			chunk_id > 0 ? "k" : "m",
+			num_digits(DATA_FILES_PER_BLOCK),
+			chunk_id > 0 ? chunk_id : -chunk_id);
+	if (size == -1) {
+		fprintf(stderr, "asprintf: cannot alloc chunk path\n");
+		return -1;
 	}
-	return num_dropped;
+	send_file(s, cli, cli_len, store, chunk_path, block_id, chunk_id);
+	free(chunk_path);
+	return 0;
 }
 
-static inline void send_data_files(int s, const struct sockaddr *cli,
-					   int cli_len, const char *filename,
-					   __u32 num_blocks, __u16 padding,
-					   unsigned int fr)
+struct spray_cfg {
+	unsigned int	fr;
+	/* Send the file over and over until spray is killed. */
+	int		carousel;
+	/* Rate control algorithm, and its rate in packets per second. */
+	const char	*ratectl;
+	double		pps;
+	/* Listen for FOUNTAIN_CTL_DONE messages from the receiver. */
+	int		feedback;
+	/* Seconds to keep answering repair requests after the last pass. */
+	unsigned int	linger;
+	/* Completion probability that adaptive redundancy aims for. */
+	double		target;
+	/* Send order, and its window in blocks. */
+	const char	*sched;
+	__u32		depth;
+	/* Simulated network; its loss defaults to @fr percent. */
+	const char	*impair_spec;
+	struct impair_cfg impair;
+	/* This instance sends shard @shard of @shards of the chunks of
+	 * transfer @session.
+	 */
+	__u32		shard;
+	__u32		shards;
+	__u32		session;
+};
+
+static void report(void *arg, const struct fountain_report *rep)
 {
-	int num_dropped = send_files(s, cli, cli_len, filename,
-				     "k", num_blocks,
-				     DATA_FILES_PER_BLOCK, padding, 1, fr);
+	ratectl_report(arg, rep);
+}
 
-	if (num_dropped == -1)
-		return;
+/* State of one spray() call. */
+struct spray_run {
+	int			s;
+	const struct sockaddr	*cli;
+	int			cli_len;
+	struct chunk_store	*store;
+	const struct spray_cfg	*cfg;
+	struct ratectl		rc;
+	struct sched		sched;
+	struct impair		imp;
+	struct feedback		*fb;
+	unsigned long		num_pkts;
+	unsigned int		repair_sent;
+	unsigned int		repair_dropped;
+	unsigned int		code_skipped;
+	unsigned long		shard_skipped;
+};
+
+/* The shards of a transfer split the chunks of every block between
+ * them by chunk index, shifted by one shard per block so that each
+ * sends its share of the data chunks, which spare the receiver a
+ * decode. Every chunk is sent by exactly one shard.
+ */
+static inline int in_shard(const struct spray_cfg *cfg, __u32 block_id,
+			   int idx)
+{
+	return (block_id + idx) % cfg->shards == cfg->shard;
+}
 
-	fprintf(stderr, "Dropped %d data packets out of %d (%.1f%%)\n",
-		num_dropped, DATA_FILES_PER_BLOCK * num_blocks,
-		100 * (float)num_dropped / (DATA_FILES_PER_BLOCK * num_blocks));
+/* Answer a NACK of @block_id with the chunks the receiver lacks. */
+static void repair_block(void *arg, __u32 block_id, __u32 recv_mask)
+{
+	struct spray_run *run = arg;
+	__s16 chunk_ids[DATA_FILES_PER_BLOCK];
+	unsigned int i, n = feedback_repair_ids(recv_mask, chunk_ids);
+
+	for (i = 0; i < n; i++) {
+		run->repair_sent++;
+		ratectl_pace(&run->rc);
+		ratectl_sent(&run->rc, block_id, chunk_ids[i]);
+		if (impair_lose(&run->imp)) {
+			run->repair_dropped++;
+			continue;
+		}
+		if (send_store_chunk(run->s, run->cli, run->cli_len,
+				     run->store, block_id, chunk_ids[i]))
+			break;
+	}
+	impair_flush(&run->imp, run->s);
 }
 
-static inline void send_code_files(int s, const struct sockaddr *cli,
-					   int cli_len, const char *filename,
-					   __u32 num_blocks, __u16 padding,
-					   unsigned int fr)
+/* Send every chunk of @store once, in the order of @run->sched. */
+static int send_pass(int s, const struct sockaddr *cli, int cli_len,
+		     struct chunk_store *store, struct spray_run *run)
 {
-	int num_dropped = send_files(s, cli, cli_len, filename,
-				     "m", num_blocks,
-				     CODE_FILES_PER_BLOCK, padding, 0, fr);
+	struct feedback *fb = run->fb;
+	int num_tried[2] = {0, 0}, num_dropped[2] = {0, 0};
+	__u64 pos;
+
+	for (pos = 0; pos < run->sched.len; pos++) {
+		__u32 block_id;
+		int idx, is_data;
+		__s16 chunk_id;
+
+		sched_at(&run->sched, pos, &block_id, &idx);
+		if (!in_shard(run->cfg, block_id, idx)) {
+			run->shard_skipped++;
+			continue;
+		}
+		is_data = idx < DATA_FILES_PER_BLOCK;
+		chunk_id = is_data ? idx + 1 : DATA_FILES_PER_BLOCK - idx - 1;
+
+		if (fb) {
+			if (run->num_pkts++ % FEEDBACK_POLL_PKTS == 0)
+				feedback_poll(fb, s);
+			if (feedback_done(fb, block_id)) {
+				fb->skipped++;
+				continue;
+			}
+		}
+		if (!is_data && -chunk_id > run->rc.code_chunks) {
+			run->code_skipped++;
+			continue;
+		}
+		num_tried[is_data]++;
 
-	if (num_dropped == -1)
-		return;
+		ratectl_pace(&run->rc);
+		ratectl_sent(&run->rc, block_id, chunk_id);
+		if (impair_lose(&run->imp)) {
+			num_dropped[is_data]++;
+			continue;
+		}
+		if (send_store_chunk(s, cli, cli_len, store, block_id,
+				     chunk_id))
+			return -1;
+	}
 
+	fprintf(stderr, "Dropped %d data packets out of %d (%.1f%%)\n",
+		num_dropped[1], num_tried[1], num_tried[1]
+		? 100 * (float)num_dropped[1] / num_tried[1] : 0);
 	fprintf(stderr, "Dropped %d code packets out of %d (%.1f%%)\n",
-		num_dropped, CODE_FILES_PER_BLOCK * num_blocks,
-		100 * (float)num_dropped / (CODE_FILES_PER_BLOCK * num_blocks));
+		num_dropped[0], num_tried[0], num_tried[0]
+		? 100 * (float)num_dropped[0] / num_tried[0] : 0);
+	return 0;
 }
 
-void spray(int s, const struct sockaddr *cli, int cli_len,
-	   const char *file_path, __u16 padding, unsigned int fr)
+static inline int all_done(const struct spray_run *run)
 {
-	char *filename = basename(file_path);
-	char *encoded_file_path;
-	int size;
-	int num_blocks;
+	return run->fb && run->fb->num_done == run->fb->num_blocks;
+}
 
-        size = asprintf(&encoded_file_path, "%s/%s", ENCODED_DIR, filename);
-        if (size == -1) {
-                fprintf(stderr,
-                        "asprintf: cannot allocate encoded file path\n");
-                return;
-        }
+/* In carousel mode, the whole file is sent over and over at a fixed
+ * rate until spray is killed. A receiver can join at any point and
+ * leave as soon as it holds any k chunks of every block, and the
+ * bandwidth used does not depend on how many receivers listen.
+ *
+ * With feedback, chunks of the blocks that the receiver reported
+ * complete are skipped, and a carousel stops once all blocks are.
+ * Repair requests are answered as they come, and for cfg->linger
+ * seconds after the last pass. Receiver reports drive the rate
+ * control.
+ */
+void spray(int s, const struct sockaddr *cli, int cli_len,
+	   const char *file_path, __u16 padding, const struct spray_cfg *cfg)
+{
+	struct chunk_store store;
+	struct spray_run run;
+	struct feedback fb;
+	unsigned long pass = 0;
 
-	/* Check if a directory for that name exists. */
-	if (!dir_exists(encoded_file_path)) {
-		fprintf(stderr,
-			"invalid request; %s encoding does not exist\n",
-			filename);
+	if (open_store(&store, file_path, padding))
 		return;
-	}
 
-	num_blocks = get_num_blocks(filename);
-	if (num_blocks == -1) {
-		fprintf(stderr,
-			"get_num_blocks: cannot find number of blocks\n");
-		return;
+	store.hdr.session = htonl(cfg->session);
+
+	memset(&run, 0, sizeof(run));
+	run.s = s;
+	run.cli = cli;
+	run.cli_len = cli_len;
+	run.store = &store;
+	run.cfg = cfg;
+	if (sched_init(&run.sched, cfg->sched, store.num_blocks,
+		       DATA_FILES_PER_BLOCK + CODE_FILES_PER_BLOCK, cfg->depth,
+		       SCHED_SEED)) {
+		fprintf(stderr, "Cannot set up send order %s\n", cfg->sched);
+		goto close;
+	}
+	if (impair_init(&run.imp, &cfg->impair))
+		goto sched;
+	if (ratectl_init(&run.rc, cfg->ratectl, cfg->pps)) {
+		fprintf(stderr, "Cannot set up rate control %s\n",
+			cfg->ratectl);
+		goto imp;
+	}
+	fountain_set_send_hook(impair_send, &run.imp);
+	ratectl_set_target(&run.rc, cfg->target);
+	if (cfg->feedback || cfg->linger || cfg->target ||
+	    strcmp(cfg->ratectl, "fixed")) {
+		if (feedback_init(&fb, store.filename, store.num_blocks)) {
+			fprintf(stderr, "Cannot allocate feedback state\n");
+			goto rc;
+		}
+		fb.repair = repair_block;
+		fb.repair_arg = &run;
+		fb.report = report;
+		fb.report_arg = &run.rc;
+		run.fb = &fb;
 	}
 
-	send_data_files(s, cli, cli_len, filename, num_blocks, padding, fr);
-	send_code_files(s, cli, cli_len, filename, num_blocks, padding, fr);
+	do {
+		if (send_pass(s, cli, cli_len, &store, &run))
+			break;
+		if (cfg->carousel)
+			fprintf(stderr, "Carousel pass %lu done\n", ++pass);
+	} while (cfg->carousel && !all_done(&run));
+	impair_flush(&run.imp, s);
+
+	if (run.fb) {
+		if (cfg->linger)
+			feedback_linger(&fb, s, cfg->linger);
+		fprintf(stderr, "Skipped %lu packets (%lu bytes) of %u blocks "
+			"reported complete\n", fb.skipped,
+			fb.skipped * (sizeof(struct fountain_hdr) + CHUNK_SIZE),
+			fb.num_done);
+		fprintf(stderr, "Dropped %u repair packets out of %u\n",
+			run.repair_dropped, run.repair_sent);
+		feedback_free(&fb);
+	}
+	if (cfg->shards > 1)
+		fprintf(stderr, "Shard %u of %u of session %u: left %lu chunks "
+			"to the other shards\n", cfg->shard, cfg->shards,
+			cfg->session, run.shard_skipped);
+	if (store.num_corrupt)
+		fprintf(stderr, "Skipped %u chunks that failed their "
+			"checksum\n", store.num_corrupt);
+	if (cfg->target)
+		fprintf(stderr, "Skipped %u coding packets (%lu bytes), "
+			"%d of %d per block at the end\n", run.code_skipped,
+			run.code_skipped *
+			(sizeof(struct fountain_hdr) + CHUNK_SIZE),
+			run.rc.code_chunks, CODE_FILES_PER_BLOCK);
+	fprintf(stderr, "Rate control %s: %.0f pps at the end, %lu reports, "
+		"%.1f%% loss, %.3f ms RTT\n", cfg->ratectl, run.rc.rate,
+		run.rc.num_reports, 100 * run.rc.loss, 1000 * run.rc.srtt);
+	arena_print_stats(stderr, "Packet buffers", &store.arena.stats);
+rc:
+	impair_print_stats(&run.imp);
+	fountain_set_send_hook(NULL, NULL);
+	ratectl_free(&run.rc);
+imp:
+	impair_free(&run.imp);
+sched:
+	sched_free(&run.sched);
+close:
+	close_store(&store);
 }
 
-static int check_srv_params(int argc, char * const argv[])
+static int check_srv_params(int argc, char * const argv[],
+			    struct spray_cfg *cfg)
 {
-	UNUSED(argv);
-	if (argc != 6) {
+	int opt;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->ratectl = "fixed";
+	cfg->pps = RATECTL_DEF_PPS;
+	cfg->sched = "chunk";
+	cfg->depth = DEF_DEPTH;
+	cfg->shards = 1;
+	while ((opt = getopt(argc, argv, "C:p:R:FL:A:s:w:P:i:I:")) != -1) {
+		switch (opt) {
+		case 'P':
+			if (sscanf(optarg, "%u/%u", &cfg->shard,
+				   &cfg->shards) != 2 || !cfg->shards ||
+			    cfg->shard >= cfg->shards) {
+				fprintf(stderr, "Invalid shard: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'i':
+			if (sscanf(optarg, "%u", &cfg->session) != 1) {
+				fprintf(stderr, "Invalid session: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'I':
+			cfg->impair_spec = optarg;
+			break;
+		case 's':
+			cfg->sched = optarg;
+			if (!sched_find(optarg)) {
+				fprintf(stderr, "Unknown send order: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'w':
+			if (sscanf(optarg, "%u", &cfg->depth) != 1 ||
+			    !cfg->depth) {
+				fprintf(stderr, "Invalid window: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'C':
+			cfg->carousel = 1;
+			/* Fall through. */
+		case 'p':
+			if (sscanf(optarg, "%lf", &cfg->pps) != 1 ||
+			    cfg->pps < 1) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'R':
+			cfg->ratectl = optarg;
+			if (!ratectl_find(optarg)) {
+				fprintf(stderr, "Unknown rate control: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'A':
+			if (sscanf(optarg, "%lf", &cfg->target) != 1 ||
+			    cfg->target <= 0 || cfg->target >= 1) {
+				fprintf(stderr, "Invalid target: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'F':
+			cfg->feedback = 1;
+			break;
+		case 'L':
+			if (sscanf(optarg, "%u", &cfg->linger) != 1 ||
+			    !cfg->linger) {
+				fprintf(stderr, "Invalid linger time: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		default:
+			printf(USAGE);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 5) {
 		printf(USAGE);
 		return 1;
 	}
+
+	/* Blocks that fall short of k chunks are completed by repair. */
+	if (cfg->target && !cfg->linger)
+		cfg->linger = DEF_LINGER;
 	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	struct sockaddr *srv, *cli;
+	struct spray_cfg cfg;
 	int s, srv_len, cli_len, rc;
-	unsigned int fr;
 	__u16 padding;
 
-	if (check_srv_params(argc, argv))
+	if (check_srv_params(argc, argv, &cfg))
 		exit(1);
+	argv += optind - 1;
 
 	s = socket(AF_XIA, SOCK_DGRAM, get_xdp_type());
 	if (s < 0) {
@@ -249,7 +747,7 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	rc = sscanf(argv[5], "%d", &fr);
+	rc = sscanf(argv[5], "%u", &cfg.fr);
 	if (errno != 0) {
 		fprintf(stderr, "%s: sscanf errno=%i: %s\n",
 			__func__, errno, strerror(errno));
@@ -259,12 +757,15 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	if (fr > 100) {
+	if (cfg.fr > 100) {
 		fprintf(stderr, "Failure rate must be between 0 and 100.\n");
 		return 1;
 	}
+	cfg.impair.loss = cfg.fr / 100.0;
+	if (cfg.impair_spec && impair_parse(&cfg.impair, cfg.impair_spec))
+		return 1;
 
-	spray(s, cli, cli_len, argv[3], padding, fr);
+	spray(s, cli, cli_len, argv[3], padding, &cfg);
 	fprintf(stderr, "File sent.\n");
 
 	free(cli);
@@ -24,7 +24,12 @@ WORD_SIZE =	8
 
 USAGE =
   "\nUsage:\n"                           \
-  "\truby spray.rb srv-bind-addr srv-dst-addr data-path failure-rate\n\n"
+  "\truby spray.rb [--parity-only] [--packed] srv-bind-addr srv-dst-addr " \
+  "data-path failure-rate\n\n"          \
+  "With --parity-only, only the coding chunks are stored under encoded/,\n" \
+  "and spray reads the data chunks from data-path.\n"                     \
+  "With --packed, the chunks are stored in the single checksummed\n"      \
+  "container encoded/<file>.fec, which spray maps and sends from.\n\n"
 
 def pad_with_zeros(file_path, padding)
   `dd if=/dev/zero status=none bs=1 count=#{padding} >> #{file_path}`
@@ -38,11 +43,22 @@ def encode_block(file_splits_path, filename, block, num_digits)
               #{CODING_TECH} #{WORD_SIZE} 1 0`
 end
 
+# Encode the whole file in one pass, one block per read-in, into a
+# parity-only store and/or a packed container.
+def encode_store(file_path, filename, options)
+  `#{ENCODER} #{file_path} #{filename} b #{NUM_DATA_FILES}	\
+              #{NUM_CODE_FILES} #{CODING_TECH} #{WORD_SIZE} 1	\
+              #{BLOCK_LEN} #{options.join(",")}`
+end
+
 def backup(s)
   return s + BAK_EXT
 end
 
 if __FILE__ == $PROGRAM_NAME
+  options = []
+  options << "parity" if ARGV.delete("--parity-only")
+  options += ["packed", "csum"] if ARGV.delete("--packed")
   if ARGV.length != 4 or !File.exists?(ARGV[1])
     puts(USAGE)
     exit
@@ -71,12 +87,22 @@ if __FILE__ == $PROGRAM_NAME
   # Check if an encoding already exists for this file.
   # If it does, we don't have to encode it, we just
   # need to send it.
-  if Dir.exists?(File.join(ENCODED_DIR, filename))
+  if Dir.exists?(File.join(ENCODED_DIR, filename)) or
+     File.exists?(File.join(ENCODED_DIR, filename + ".fec"))
     puts("Sending previously encoded files for #{file_path}...")
     system("./spray #{ARGV[0]} #{ARGV[1]} #{ARGV[2]} #{padding} #{ARGV[3]}")
     exit
   end
 
+  if !options.empty?
+    puts("Encoding...")
+    FileUtils.mkdir_p(ENCODED_DIR)
+    encode_store(file_path, filename, options)
+    puts("Sending packets...")
+    system("./spray #{ARGV[0]} #{ARGV[1]} #{ARGV[2]} #{padding} #{ARGV[3]}")
+    exit
+  end
+
   # Pad with zeros up to the nearest multiple of BLOCK_LEN, if necessary.
   if padding > 0
     FileUtils.cp(file_path, backup(file_path))
@@ -0,0 +1,503 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "fountain.h"
+#include "fecfile.h"
+
+#define USAGE	"usage:\t./sprayd [-r session-pps] [-R total-pps] "\
+		"[-n max-sessions] [-d data-dir] srv-bind-addr\n"
+
+#define ENCODED_DIR		"encoded"
+#define CHUNKS_PER_BLOCK	(DATA_FILES_PER_BLOCK + CODE_FILES_PER_BLOCK)
+#define TICK_NSEC		1000000
+#define DEF_SESSION_PPS		10000
+#define DEF_MAX_SESSIONS	1024
+
+/* A packed container mapped once and shared by all sessions that
+ * serve it. Parity-only containers also keep their source open.
+ */
+struct served_file {
+	struct served_file	*next;
+	char			name[FILENAME_MAX_LEN + 1];
+	struct fec_file		fec;
+	int			src_fd;
+	__u16			padding;
+	unsigned int		refs;
+};
+
+/* One receiver pulling one file. Chunks go out in the same order as
+ * from spray: chunk 1 of every block, then chunk 2, and so on.
+ */
+struct session {
+	struct session		*prev;
+	struct session		*next;
+	struct tmp_sockaddr_storage addr;
+	socklen_t		addr_len;
+	struct served_file	*file;
+	struct fountain_hdr	hdr;
+	__u64			pos;
+	__u64			total;
+	double			tokens;
+	double			start;
+};
+
+struct sprayd {
+	int			s;
+	int			epfd;
+	int			timerfd;
+	const char		*data_dir;
+	struct served_file	*files;
+	struct session		*sessions;	/* Next session to serve. */
+	unsigned int		num_sessions;
+	unsigned int		max_sessions;
+	double			session_pps;
+	double			total_pps;
+	double			total_tokens;
+	double			last_tick;
+	int			blocked;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static struct served_file *get_file(struct sprayd *d, const char *name)
+{
+	struct served_file *f;
+	const struct fec_hdr *hdr;
+	char *path;
+	int rc;
+
+	for (f = d->files; f; f = f->next)
+		if (!strcmp(f->name, name)) {
+			f->refs++;
+			return f;
+		}
+
+	f = calloc(1, sizeof(*f));
+	assert(f);
+	snprintf(f->name, sizeof(f->name), "%s", name);
+	f->src_fd = -1;
+
+	rc = asprintf(&path, "%s/%s.fec", ENCODED_DIR, name);
+	assert(rc != -1);
+	rc = fec_open(&f->fec, path);
+	free(path);
+	if (rc < 0) {
+		fprintf(stderr, "No packed encoding of %s: %s\n", name,
+			strerror(errno));
+		goto free;
+	}
+
+	hdr = f->fec.hdr;
+	if (hdr->k != DATA_FILES_PER_BLOCK ||
+	    hdr->m != CODE_FILES_PER_BLOCK || hdr->chunk_size != CHUNK_SIZE ||
+	    !hdr->num_blocks) {
+		fprintf(stderr, "%s.fec was encoded with other parameters\n",
+			name);
+		goto fec;
+	}
+	f->padding = (__u64)hdr->num_blocks * BLOCK_SIZE - hdr->orig_size;
+
+	if (hdr->flags & FEC_F_PARITY_ONLY) {
+		struct stat st;
+
+		rc = asprintf(&path, "%s/%s", d->data_dir, name);
+		assert(rc != -1);
+		f->src_fd = open(path, O_RDONLY);
+		free(path);
+		if (f->src_fd < 0 || fstat(f->src_fd, &st) < 0 ||
+		    (__u64)st.st_size != hdr->orig_size ||
+		    st.st_mtime != hdr->src_mtime) {
+			fprintf(stderr, "Source of %s is missing or changed\n",
+				name);
+			goto src;
+		}
+	}
+
+	f->refs = 1;
+	f->next = d->files;
+	d->files = f;
+	return f;
+
+src:
+	if (f->src_fd >= 0)
+		close(f->src_fd);
+fec:
+	fec_close(&f->fec);
+free:
+	free(f);
+	return NULL;
+}
+
+static void put_file(struct sprayd *d, struct served_file *f)
+{
+	struct served_file **pf;
+
+	if (--f->refs)
+		return;
+
+	for (pf = &d->files; *pf != f; pf = &(*pf)->next)
+		;
+	*pf = f->next;
+	if (f->src_fd >= 0)
+		close(f->src_fd);
+	fec_close(&f->fec);
+	free(f);
+}
+
+static struct session *find_session(struct sprayd *d,
+				    const struct sockaddr *addr,
+				    socklen_t addr_len, const char *name)
+{
+	struct session *sess = d->sessions;
+	unsigned int i;
+
+	for (i = 0; i < d->num_sessions; i++, sess = sess->next)
+		if (!strcmp(sess->file->name, name) &&
+		    address_match((struct sockaddr *)&sess->addr,
+				  sess->addr_len, addr, addr_len))
+			return sess;
+	return NULL;
+}
+
+static void add_session(struct sprayd *d, const struct sockaddr *addr,
+			socklen_t addr_len, const char *name)
+{
+	struct served_file *f;
+	struct session *sess;
+
+	if (find_session(d, addr, addr_len, name))
+		/* Already serving it; the request was a retransmission. */
+		return;
+	if (d->num_sessions >= d->max_sessions) {
+		fprintf(stderr, "Rejecting %s: too many sessions\n", name);
+		return;
+	}
+
+	f = get_file(d, name);
+	if (!f)
+		return;
+
+	sess = calloc(1, sizeof(*sess));
+	assert(sess);
+	memcpy(&sess->addr, addr, addr_len);
+	sess->addr_len = addr_len;
+	sess->file = f;
+	sess->total = (__u64)f->fec.hdr->num_blocks * CHUNKS_PER_BLOCK;
+	sess->start = now();
+	fountain_hdr_init(&sess->hdr, name, f->fec.hdr->num_blocks,
+			  f->padding);
+
+	if (d->sessions) {
+		sess->next = d->sessions;
+		sess->prev = d->sessions->prev;
+		sess->prev->next = sess;
+		sess->next->prev = sess;
+	} else {
+		sess->next = sess->prev = sess;
+		d->sessions = sess;
+	}
+	d->num_sessions++;
+	fprintf(stderr, "Serving %s, %u session(s)\n", name,
+		d->num_sessions);
+}
+
+static void del_session(struct sprayd *d, struct session *sess)
+{
+	fprintf(stderr, "Served %s in %.3f s, %u session(s) left\n",
+		sess->file->name, now() - sess->start, d->num_sessions - 1);
+
+	if (sess->next == sess) {
+		d->sessions = NULL;
+	} else {
+		sess->prev->next = sess->next;
+		sess->next->prev = sess->prev;
+		if (d->sessions == sess)
+			d->sessions = sess->next;
+	}
+	d->num_sessions--;
+	put_file(d, sess->file);
+	free(sess);
+}
+
+/* Send the next chunk of @sess. Returns -1 if the socket is full. */
+static int send_next(struct sprayd *d, struct session *sess)
+{
+	struct served_file *f = sess->file;
+	__u32 num_blocks = f->fec.hdr->num_blocks;
+	__u32 block_id = sess->pos % num_blocks;
+	int idx = sess->pos / num_blocks;
+	int slot = fec_slot(&f->fec, idx);
+	__s16 chunk_id = idx < DATA_FILES_PER_BLOCK
+		? idx + 1 : DATA_FILES_PER_BLOCK - idx - 1;
+	__u8 buf[CHUNK_SIZE];
+	const __u8 *chunk;
+	ssize_t rc;
+
+	if (slot < 0) {
+		/* Parity-only container: the data chunk is in the source. */
+		rc = pread(f->src_fd, buf, CHUNK_SIZE,
+			   (off_t)block_id * BLOCK_SIZE + idx * CHUNK_SIZE);
+		if (rc < 0) {
+			/* Zeros would pass for the chunk; send none. */
+			fprintf(stderr, "%s: pread errno=%i: %s\n",
+				__func__, errno, strerror(errno));
+			sess->pos++;
+			return 0;
+		}
+		/* Only the padding of the last block is past the end. */
+		memset(buf + rc, 0, CHUNK_SIZE - rc);
+		chunk = buf;
+	} else if (!fec_chunk_ok(&f->fec, block_id, slot)) {
+		/* Let the receiver rebuild it from other chunks. */
+		sess->pos++;
+		return 0;
+	} else {
+		chunk = fec_chunk(&f->fec, block_id, slot);
+	}
+
+	rc = try_send_chunk(d->s, (struct sockaddr *)&sess->addr,
+			    sess->addr_len, &sess->hdr, block_id, chunk_id,
+			    chunk, CHUNK_SIZE);
+	if (rc < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+			return -1;
+		fprintf(stderr, "%s: sendmsg errno=%i: %s\n",
+			__func__, errno, strerror(errno));
+	}
+	sess->pos++;
+	return 0;
+}
+
+static void set_blocked(struct sprayd *d, int blocked)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | (blocked ? EPOLLOUT : 0),
+		.data.fd = d->s,
+	};
+
+	if (d->blocked == blocked)
+		return;
+	assert(!epoll_ctl(d->epfd, EPOLL_CTL_MOD, d->s, &ev));
+	d->blocked = blocked;
+}
+
+/* Serve the sessions round-robin, one chunk per session per round, so
+ * every session gets its share of the tokens regardless of how many
+ * other sessions there are.
+ */
+static void serve_sessions(struct sprayd *d)
+{
+	int progress = 1;
+
+	while (progress && d->sessions) {
+		unsigned int i, n = d->num_sessions;
+
+		progress = 0;
+		for (i = 0; i < n && d->sessions; i++) {
+			struct session *sess = d->sessions;
+
+			d->sessions = sess->next;
+			if (sess->tokens < 1)
+				continue;
+			if (d->total_pps && d->total_tokens < 1)
+				return;
+
+			if (send_next(d, sess) < 0) {
+				set_blocked(d, 1);
+				return;
+			}
+			sess->tokens--;
+			d->total_tokens--;
+			progress = 1;
+
+			if (sess->pos == sess->total)
+				del_session(d, sess);
+		}
+	}
+	set_blocked(d, 0);
+}
+
+static void tick(struct sprayd *d)
+{
+	double t = now(), dt = t - d->last_tick;
+	struct session *sess = d->sessions;
+	unsigned int i;
+	__u64 expirations;
+
+	assert(read(d->timerfd, &expirations, sizeof(expirations)) ==
+	       sizeof(expirations));
+	d->last_tick = t;
+
+	/* Allow bursts of up to 10 ms worth of tokens. */
+	for (i = 0; i < d->num_sessions; i++, sess = sess->next) {
+		sess->tokens += d->session_pps * dt;
+		if (sess->tokens > d->session_pps / 100 + 1)
+			sess->tokens = d->session_pps / 100 + 1;
+	}
+	if (d->total_pps) {
+		d->total_tokens += d->total_pps * dt;
+		if (d->total_tokens > d->total_pps / 100 + 1)
+			d->total_tokens = d->total_pps / 100 + 1;
+	}
+}
+
+static void recv_requests(struct sprayd *d)
+{
+	struct tmp_sockaddr_storage addr;
+	union {
+		struct fountain_ctl ctl;
+		char buf[512];
+	} msg;
+	char name[FILENAME_MAX_LEN + 1];
+	socklen_t addr_len;
+	ssize_t n;
+
+	while (1) {
+		addr_len = sizeof(addr);
+		n = recvfrom(d->s, &msg, sizeof(msg), MSG_DONTWAIT,
+			     (struct sockaddr *)&addr, &addr_len);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				fprintf(stderr, "%s: recvfrom errno=%i: %s\n",
+					__func__, errno, strerror(errno));
+			return;
+		}
+		if (fountain_ctl_type(&msg, n) != FOUNTAIN_CTL_REQ)
+			continue;
+
+		snprintf(name, sizeof(name), "%.*s", FILENAME_MAX_LEN,
+			 msg.ctl.filename);
+		if (!*name || strchr(name, '/'))
+			continue;
+		add_session(d, (struct sockaddr *)&addr, addr_len, name);
+	}
+}
+
+static void run(struct sprayd *d)
+{
+	struct itimerspec its = {
+		.it_interval = {.tv_sec = 0, .tv_nsec = TICK_NSEC},
+		.it_value = {.tv_sec = 0, .tv_nsec = TICK_NSEC},
+	};
+	struct epoll_event ev;
+
+	d->epfd = epoll_create1(0);
+	assert(d->epfd >= 0);
+	d->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	assert(d->timerfd >= 0);
+	assert(!timerfd_settime(d->timerfd, 0, &its, NULL));
+	d->last_tick = now();
+
+	ev.events = EPOLLIN;
+	ev.data.fd = d->s;
+	assert(!epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->s, &ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = d->timerfd;
+	assert(!epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->timerfd, &ev));
+
+	while (1) {
+		struct epoll_event events[2];
+		int i, n;
+
+		n = epoll_wait(d->epfd, events, 2, -1);
+		if (n < 0) {
+			assert(errno == EINTR);
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == d->timerfd)
+				tick(d);
+			else if (events[i].events & EPOLLIN)
+				recv_requests(d);
+		}
+		serve_sessions(d);
+	}
+}
+
+static int parse_double(const char *str, const char *what, double *val)
+{
+	if (sscanf(str, "%lf", val) != 1 || *val < 0) {
+		fprintf(stderr, "Invalid %s: %s\n", what, str);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr *srv;
+	struct sprayd d;
+	int srv_len, opt;
+
+	memset(&d, 0, sizeof(d));
+	d.session_pps = DEF_SESSION_PPS;
+	d.max_sessions = DEF_MAX_SESSIONS;
+	d.data_dir = ".";
+
+	while ((opt = getopt(argc, argv, "r:R:n:d:")) != -1) {
+		switch (opt) {
+		case 'r':
+			if (parse_double(optarg, "session rate",
+					 &d.session_pps))
+				return 1;
+			/* A session at no rate would never end. */
+			if (!d.session_pps) {
+				fprintf(stderr, "Invalid session rate: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'R':
+			if (parse_double(optarg, "total rate", &d.total_pps))
+				return 1;
+			break;
+		case 'n':
+			if (sscanf(optarg, "%u", &d.max_sessions) != 1) {
+				fprintf(stderr, "Invalid session limit: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			d.data_dir = optarg;
+			break;
+		default:
+			printf(USAGE);
+			return 1;
+		}
+	}
+	if (argc - optind != 1) {
+		printf(USAGE);
+		return 1;
+	}
+
+	d.s = socket(AF_XIA, SOCK_DGRAM | SOCK_NONBLOCK, get_xdp_type());
+	if (d.s < 0) {
+		int orig_errno = errno;
+		fprintf(stderr, "Cannot create XDP socket: %s\n",
+			strerror(orig_errno));
+		return 1;
+	}
+
+	srv = get_addr(argv[optind], &srv_len);
+	assert(srv);
+	assert(!bind(d.s, srv, srv_len));
+
+	run(&d);
+	return 0;
+}